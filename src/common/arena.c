@@ -0,0 +1,105 @@
+/* for MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE */
+#define _DEFAULT_SOURCE
+#include "arena.h"
+#include "logging.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Pages the mapping is aligned to, so the kernel can back it with THPs */
+#define ARENA_HUGE ((size_t)2 << 20)
+#define ARENA_PAGE ((size_t)4096)
+/* Cache lines per page, how many different offsets allocations cycle over */
+#define ARENA_LINES (ARENA_PAGE / ARENA_ALIGN)
+
+size_t
+arena_pitch(size_t w)
+{
+  size_t align = ARENA_ALIGN / sizeof(double);
+  size_t pitch = (w + align - 1) / align * align;
+  if (!(pitch * sizeof(double) % ARENA_PAGE))
+    pitch += align;
+  return pitch;
+}
+
+size_t
+arena_reserve(size_t size)
+{
+  /* Rounding up to the next page plus the cache line offset within it */
+  return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN + 2 * ARENA_PAGE;
+}
+
+int
+arena_init(struct arena *arena, size_t size)
+{
+  memset(arena, 0, sizeof(*arena));
+  size = (size + ARENA_HUGE - 1) / ARENA_HUGE * ARENA_HUGE;
+  void *map = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  /* Only works if the admin reserved huge pages (vm.nr_hugepages) */
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
+      MAP_HUGETLB, -1, 0);
+#endif
+  if (map != MAP_FAILED) {
+    arena->map = arena->base = map;
+    arena->map_size = arena->size = size;
+    arena->huge = true;
+    return 0;
+  }
+  /* Map an extra huge page so we can align the start to one */
+  map = mmap(NULL, size + ARENA_HUGE, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+      MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERROR("Could not map a %zu bytes arena: %s\n", size, strerror(errno));
+    return 1;
+  }
+  arena->map = map;
+  arena->map_size = size + ARENA_HUGE;
+  arena->base = (char *)(((uintptr_t)map + ARENA_HUGE - 1) & ~(ARENA_HUGE -
+        1));
+  arena->size = size;
+#ifdef MADV_HUGEPAGE
+  if (madvise(arena->base, size, MADV_HUGEPAGE))
+    LOG_INFO("Transparent huge pages not available: %s\n", strerror(errno));
+#endif
+  return 0;
+}
+
+/* Returns size bytes at offset bytes into the first page after the used ones */
+static void *
+arena_take(struct arena *arena, size_t size, size_t offset)
+{
+  size_t start = (arena->used + ARENA_PAGE - 1) / ARENA_PAGE * ARENA_PAGE +
+    offset;
+  if (start > arena->size || arena->size - start < size) {
+    LOG_ERROR("Arena out of room for %zu bytes\n", size);
+    errno = ENOMEM;
+    return NULL;
+  }
+  arena->used = start + size;
+  arena->allocs++;
+  /* Fresh anonymous memory, already zeroed */
+  return arena->base + start;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+  /* Start on a new page, at the next cache line offset within it */
+  return arena_take(arena, size, arena->allocs % ARENA_LINES * ARENA_ALIGN);
+}
+
+void *
+arena_alloc_page(struct arena *arena, size_t size)
+{
+  return arena_take(arena, size, 0);
+}
+
+void
+arena_free(struct arena *arena)
+{
+  if (arena->map)
+    munmap(arena->map, arena->map_size);
+  memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+ * Arena for the grids and frame buffers. Everything comes from a single
+ * mapping, backed by explicit huge pages if the system has them reserved, by
+ * transparent huge pages otherwise, and by regular pages if neither works.
+ * With 2MB pages a 512MB buffer needs 256 TLB entries instead of 131072.
+ *
+ * Allocations are ARENA_ALIGN aligned, and each starts on a different cache
+ * line within its page, so two grids indexed the same way (surface and
+ * osurface) do not alias each other on the 4K boundary. Grids are laid out in
+ * rows of arena_pitch(w) doubles so every row is aligned too.
+ *
+ * There is no way to free a single allocation, the whole arena is unmapped by
+ * arena_free.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN 64
+
+struct arena {
+  /* The mapping, as returned by mmap */
+  void *map;
+  size_t map_size;
+  /* Where allocations start and how much of it is used */
+  char *base;
+  size_t size, used;
+  unsigned allocs;
+  bool huge;
+};
+
+/*
+ * Distance in doubles between the starts of two rows of a grid w doubles wide:
+ * w rounded up to ARENA_ALIGN bytes, plus a cache line if that would be a
+ * multiple of the page size (as with power of two widths), so that the cells
+ * of a column do not all map to the same cache set.
+ */
+size_t
+arena_pitch(size_t w);
+
+/*
+ * Bytes to reserve in the arena for an allocation of size bytes, including
+ * its padding.
+ */
+size_t
+arena_reserve(size_t size);
+
+/*
+ * Maps an arena with room for size bytes (the sum of arena_reserve for each
+ * allocation). Returns 0 on success, 1 on error, reporting the error to
+ * stderr. On error, nothing is mapped.
+ */
+int
+arena_init(struct arena *arena, size_t size);
+
+/*
+ * Returns size zeroed bytes from the arena, or NULL (with errno set) if it
+ * does not have room for them.
+ */
+void *
+arena_alloc(struct arena *arena, size_t size);
+
+/* Like arena_alloc, but page aligned (as O_DIRECT buffers must be) */
+void *
+arena_alloc_page(struct arena *arena, size_t size);
+
+/* Unmaps the arena and everything allocated from it. Fail-silent. */
+void
+arena_free(struct arena *arena);
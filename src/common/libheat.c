@@ -0,0 +1,178 @@
+/* for sched_yield */
+#define _POSIX_C_SOURCE 200112L
+#include "libheat.h"
+#include <math.h>
+#include <omp.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Spins waiting for a neighbouring band before yielding the CPU, which only
+ * helps with more threads than CPUs */
+#define HEAT_SPINS 1024
+
+/* Timesteps a band of heat_advance is done with, on a cache line of its own */
+struct heat_band {
+  uint64_t done;
+} __attribute__((aligned(64)));
+
+STENCIL_ROW(5)
+STENCIL_ROW(9)
+STENCIL_ROW(13)
+
+/*
+ * Calculates points [first, last) (1 <= first, last <= w - 1) of a row of the
+ * plate, w points wide, into out from in, with stencil. edge tells whether
+ * the row is next to the top or bottom edge of the plate. Returns the max of
+ * next and of the points calculated.
+ */
+static double
+heat_span(enum stencil stencil, double *out, double const *in, size_t w,
+    size_t first, size_t last, ptrdiff_t pitch, bool edge, double alpha,
+    double next)
+{
+  switch (stencil) {
+    case STENCIL_9:
+      return stencil_row_9(out, in, first, last, pitch, alpha, next);
+    case STENCIL_13:
+      if (edge || w < 5)
+        return stencil_row_5(out, in, first, last, pitch, alpha, next);
+      /* Points next to the left and right edges with 5 */
+      next = stencil_row_5(out, in, first, last < 2 ? last : 2, pitch,
+          alpha, next);
+      next = stencil_row_13(out, in, first > 2 ? first : 2, last < w - 2 ?
+          last : w - 2, pitch, alpha, next);
+      return stencil_row_5(out, in, first > w - 2 ? first : w - 2, last,
+          pitch, alpha, next);
+    default:
+      return stencil_row_5(out, in, first, last, pitch, alpha, next);
+  }
+}
+
+void
+heat_init(struct heat *heat, enum stencil stencil, double *plate, double
+    *next, size_t w, size_t h, size_t pitch, double alpha)
+{
+  heat->plate = plate;
+  heat->next = next;
+  heat->w = w;
+  heat->h = h;
+  heat->pitch = pitch;
+  heat->stencil = stencil;
+  heat->alpha = alpha;
+}
+
+void
+heat_fill(struct heat *heat, double edge, double inside)
+{
+  double *grids[2] = {heat->plate, heat->next};
+  for (size_t g = 0; g < 2; g++)
+    for (size_t i = 0; i < heat->h; i++)
+      for (size_t j = 0; j < heat->w; j++)
+        grids[g][i * heat->pitch + j] = i == 0 || i == heat->h - 1 || j == 0
+          || j == heat->w - 1 ? edge : inside;
+}
+
+void
+heat_mirror(struct heat *heat)
+{
+  memcpy(heat->next, heat->plate, heat->pitch * heat->h *
+      sizeof(*heat->next));
+}
+
+double
+heat_strip(struct heat const *heat, size_t first, size_t last, double next)
+{
+  for (size_t i = first; i < last; i++)
+    next = heat_span(heat->stencil, heat->next + i * heat->pitch, heat->plate
+        + i * heat->pitch, heat->w, 1, heat->w - 1, (ptrdiff_t)heat->pitch, i
+        == 1 || i == heat->h - 2, heat->alpha, next);
+  return next;
+}
+
+/* Waits for band (none if NULL) to be done with steps timesteps */
+static void
+heat_wait(struct heat_band const *band, uint64_t steps)
+{
+  if (!band)
+    return;
+  for (unsigned spins = 0; __atomic_load_n(&band->done, __ATOMIC_ACQUIRE) <
+      steps; spins++)
+    if (spins >= HEAT_SPINS)
+      sched_yield();
+}
+
+double
+heat_advance(struct heat *heat, uint64_t steps, size_t tile, double next)
+{
+  size_t w = heat->w, h = heat->h, pitch = heat->pitch;
+  if (w < 3 || h < 3 || !steps)
+    return next;
+  size_t rows = h - 2;
+  tile = tile && tile < w - 2 ? tile : w - 2;
+  /* Bands read the rows of their neighbours only, never further */
+  size_t most = rows / STENCIL_HALO[heat->stencil];
+  if (!most)
+    most = 1;
+  /* Where the band of each thread is, only written before the first timestep */
+  struct heat_band *bands[omp_get_max_threads()];
+  double edges = next;
+#pragma omp parallel reduction(max:next)
+  {
+    size_t t = (size_t)omp_get_thread_num();
+    size_t threads = (size_t)omp_get_num_threads();
+    size_t nbands = threads < most ? threads : most;
+    /* On the stack of its thread, so it shares no line with the others */
+    struct heat_band band = {0};
+    bands[t] = &band;
+#pragma omp barrier
+    if (t < nbands) {
+      size_t first = 1 + rows * t / nbands, last = 1 + rows * (t + 1) / nbands;
+      struct heat_band const *north = t ? bands[t - 1] : NULL;
+      struct heat_band const *south = t + 1 < nbands ? bands[t + 1] : NULL;
+      /* The grids swap roles for each band on its own */
+      double *in = heat->plate, *out = heat->next;
+      for (uint64_t s = 0; s < steps; s++) {
+        heat_wait(north, s);
+        heat_wait(south, s);
+        double points = edges;
+        for (size_t j = 1; j < w - 1; j += tile) {
+          size_t end = w - 1 - j > tile ? j + tile : w - 1;
+          for (size_t i = first; i < last; i++)
+            points = heat_span(heat->stencil, out + i * pitch, in + i * pitch,
+                w, j, end, (ptrdiff_t)pitch, i == 1 || i == h - 2,
+                heat->alpha, points);
+        }
+        __atomic_store_n(&band.done, s + 1, __ATOMIC_RELEASE);
+        double *swap = in;
+        in = out;
+        out = swap;
+        next = points;
+      }
+    }
+    /* The neighbours may still be waiting on band */
+#pragma omp barrier
+  }
+  if (steps % 2)
+    heat_swap(heat);
+  return next;
+}
+
+double
+heat_residual(struct heat const *heat, size_t first, size_t last)
+{
+  double ans = 0.0;
+  for (size_t i = first; i < last; i++)
+    for (size_t j = 1; j < heat->w - 1; j++)
+      ans = fmax(ans, fabs(heat->plate[i * heat->pitch + j] - heat->next[i *
+            heat->pitch + j]));
+  return ans;
+}
+
+void
+heat_swap(struct heat *heat)
+{
+  double *swap = heat->plate;
+  heat->plate = heat->next;
+  heat->next = swap;
+}
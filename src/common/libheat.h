@@ -0,0 +1,90 @@
+#pragma once
+/*
+ * libheat, the engine every front-end (seq and par in mpi/, heat in omp/)
+ * calculates its timesteps with, so the kernels and the way the grids are
+ * handled are written (and tuned) once.
+ *
+ * A plate is two grids of h rows of w points, rows pitch doubles apart, of
+ * which one is the plate as of the last timestep and the other the one being
+ * calculated. After each timestep they swap roles (heat_swap), so nothing is
+ * copied between timesteps. The points on the first and last rows and columns
+ * are never calculated: they are either the edges of the plate, which never
+ * change, or ghost rows the caller fills in (par, from the neighbouring
+ * ranks), in whichever grid is the plate at the time.
+ *
+ * The grids belong to the caller, which can get them from an arena along with
+ * everything else (see arena.h). The API is stable: LIBHEAT_VERSION changes
+ * if a function changes in an incompatible way.
+ */
+#include "stencil.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIBHEAT_VERSION 2
+
+struct heat {
+  /* The plate as of the last timestep, and the grid the next is written to */
+  double *plate, *next;
+  size_t w, h, pitch;
+  enum stencil stencil;
+  /* diffusivity * timestep / spacestep^2 */
+  double alpha;
+};
+
+/*
+ * Sets up heat to calculate timesteps of the w x h plate in the grids plate
+ * and next with stencil. plate is left as it is, see heat_fill and
+ * heat_mirror. The 13-point stencil only works on whole plates (see
+ * stencil.h), not on strips of larger ones.
+ */
+void
+heat_init(struct heat *heat, enum stencil stencil, double *plate, double
+    *next, size_t w, size_t h, size_t pitch, double alpha);
+
+/*
+ * Fills both grids with edge on the first and last rows and columns and with
+ * inside everywhere else.
+ */
+void
+heat_fill(struct heat *heat, double edge, double inside);
+
+/*
+ * Copies the plate to the other grid, so that it has the edges too. Needed
+ * once after writing the plate, not every timestep.
+ */
+void
+heat_mirror(struct heat *heat);
+
+/*
+ * Calculates rows [first, last) (1 <= first, last <= h - 1) of the next
+ * timestep, on a single thread. Returns the max of next and of the points
+ * calculated.
+ */
+double
+heat_strip(struct heat const *heat, size_t first, size_t last, double next);
+
+/*
+ * Returns the max change of a point of rows [first, last) over the last
+ * timestep, on a single thread. Only valid right after heat_swap, while the
+ * other grid still has the plate before it.
+ */
+double
+heat_residual(struct heat const *heat, size_t first, size_t last);
+
+/*
+ * Calculates steps timesteps in a single parallel region, making the last the
+ * plate. The interior rows are split in a fixed band per thread, and each
+ * band only waits for the two next to it to be done with a timestep before
+ * going on to the next (whose ghost rows they have, and whose grid they may
+ * still be reading), through a progress counter per band. There is no
+ * barrier between timesteps, so bands get ahead of those further away while
+ * the others catch up. Bands go down each column of tiles of tile columns
+ * (whole rows if 0) in turn. Returns the max of next and of the points of the
+ * last timestep.
+ */
+double
+heat_advance(struct heat *heat, uint64_t steps, size_t tile, double next);
+
+/* Makes the timestep calculated the plate */
+void
+heat_swap(struct heat *heat);
@@ -0,0 +1,146 @@
+#pragma once
+/*
+ * Downsampled levels of a w x h frame, for previewing surfaces larger than
+ * the screen without going through every point.
+ *
+ * Level k (1 <= k <= levels) halves level k - 1 in each dimension, so each
+ * of its points covers a block of up to 2^k x 2^k points of the frame (blocks
+ * on the right and bottom edges are clipped). Each level has three planes with
+ * the min, max and mean of every block, so neither hot spots nor the average
+ * temperature get lost when zooming out. Each level is computed from the
+ * previous one, weighting the means by the number of points of the frame each
+ * block covers, so the means are exact even for clipped blocks.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum pyramid_plane {
+  PYRAMID_MIN,
+  PYRAMID_MAX,
+  PYRAMID_MEAN,
+  PYRAMID_PLANES
+};
+
+struct pyramid {
+  /* Dimensions of the frame */
+  size_t w, h;
+  unsigned levels;
+  /* All levels, one after the other, each as PYRAMID_PLANES planes */
+  double *data;
+};
+
+/* Width (or height) of level k for a frame of width (or height) w */
+static inline size_t
+pyramid_dim(size_t w, unsigned k)
+{
+  return (w + ((size_t)1 << k) - 1) >> k;
+}
+
+/* Returns a plane of level k, 1 <= k <= pyramid->levels */
+static inline double *
+pyramid_plane(struct pyramid const *pyramid, unsigned k, enum pyramid_plane p)
+{
+  size_t offset = 0;
+  for (unsigned l = 1; l < k; l++)
+    offset += PYRAMID_PLANES * pyramid_dim(pyramid->w, l) *
+      pyramid_dim(pyramid->h, l);
+  return pyramid->data + offset + (size_t)p * pyramid_dim(pyramid->w, k) *
+    pyramid_dim(pyramid->h, k);
+}
+
+/*
+ * Allocates levels levels for w x h frames. Returns 0 on success, 1 on error
+ * (with errno set). On error, nothing is allocated.
+ */
+static int
+pyramid_init(struct pyramid *pyramid, size_t w, size_t h, unsigned levels)
+{
+  memset(pyramid, 0, sizeof(*pyramid));
+  if (levels >= sizeof(size_t) * 8) {
+    errno = EINVAL;
+    return 1;
+  }
+  size_t total = 0;
+  for (unsigned k = 1; k <= levels; k++)
+    total += PYRAMID_PLANES * pyramid_dim(w, k) * pyramid_dim(h, k);
+  if (total) {
+    pyramid->data = malloc(total * sizeof(*pyramid->data));
+    if (!pyramid->data)
+      return 1;
+  }
+  pyramid->w = w;
+  pyramid->h = h;
+  pyramid->levels = levels;
+  return 0;
+}
+
+static void
+pyramid_free(struct pyramid *pyramid)
+{
+  free(pyramid->data);
+  memset(pyramid, 0, sizeof(*pyramid));
+}
+
+/* Number of points of a frame of width w covered by block i of size s */
+static inline size_t
+pyramid_span(size_t w, size_t s, size_t i)
+{
+  return w - i * s < s ? w - i * s : s;
+}
+
+/*
+ * Fills level k from the three planes of level k - 1 (w x h points with rows
+ * pitch points apart, each covering an s x s block of the frame)
+ */
+static void
+pyramid_reduce(struct pyramid *pyramid, unsigned k, double const *lo,
+    double const *hi, double const *mean, size_t w, size_t h, size_t pitch,
+    size_t s)
+{
+  double *plo = pyramid_plane(pyramid, k, PYRAMID_MIN),
+         *phi = pyramid_plane(pyramid, k, PYRAMID_MAX),
+         *pmean = pyramid_plane(pyramid, k, PYRAMID_MEAN);
+  size_t pw = pyramid_dim(pyramid->w, k), ph = pyramid_dim(pyramid->h, k);
+#pragma omp parallel for collapse(2)
+  for (size_t i = 0; i < ph; i++) {
+    for (size_t j = 0; j < pw; j++) {
+      double mn = lo[2 * i * pitch + 2 * j], mx = hi[2 * i * pitch + 2 * j];
+      double sum = 0.0, count = 0.0;
+      for (size_t y = 2 * i; y < 2 * i + 2 && y < h; y++) {
+        for (size_t x = 2 * j; x < 2 * j + 2 && x < w; x++) {
+          size_t c = y * pitch + x;
+          double points = (double)(pyramid_span(pyramid->w, s, x) *
+              pyramid_span(pyramid->h, s, y));
+          if (lo[c] < mn)
+            mn = lo[c];
+          if (hi[c] > mx)
+            mx = hi[c];
+          sum += mean[c] * points;
+          count += points;
+        }
+      }
+      plo[i * pw + j] = mn;
+      phi[i * pw + j] = mx;
+      pmean[i * pw + j] = sum / count;
+    }
+  }
+}
+
+/* Computes every level of the w x h surface, with rows pitch doubles apart */
+static void
+pyramid_build(struct pyramid *pyramid, double const *surface, size_t pitch)
+{
+  /* The frame is its own min, max and mean */
+  double const *lo = surface, *hi = surface, *mean = surface;
+  size_t w = pyramid->w, h = pyramid->h;
+  for (unsigned k = 1; k <= pyramid->levels; k++) {
+    pyramid_reduce(pyramid, k, lo, hi, mean, w, h, pitch, (size_t)1 << (k -
+          1));
+    lo = pyramid_plane(pyramid, k, PYRAMID_MIN);
+    hi = pyramid_plane(pyramid, k, PYRAMID_MAX);
+    mean = pyramid_plane(pyramid, k, PYRAMID_MEAN);
+    w = pitch = pyramid_dim(pyramid->w, k);
+    h = pyramid_dim(pyramid->h, k);
+  }
+}
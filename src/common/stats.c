@@ -0,0 +1,250 @@
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "stats.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATS_MAGIC 0x7374617374616568ull /* "heatstat" */
+
+/*
+ * Reads of a slot before giving up on it, which only happens if its rank died
+ * while publishing
+ */
+#define STATS_TRIES 1000000
+
+/*
+ * Slots start on their own pair of cache lines, so the header (whose asks
+ * viewers write) is not prefetched along with the first
+ */
+#define STATS_SLOTS ((sizeof(struct stats_header) + 127) & ~(size_t)127)
+
+static size_t
+stats_size(uint32_t ranks)
+{
+  return STATS_SLOTS + (size_t)ranks * sizeof(struct stats_slot);
+}
+
+/* Maps the segment behind fd and points stats at it */
+static int
+stats_map(struct stats *stats, int fd, size_t size, int prot, char const
+    *name)
+{
+  void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERROR("%s: Could not mmap: %s\n", name, strerror(errno));
+    return 1;
+  }
+  stats->header = map;
+  stats->slots = (struct stats_slot *)((char *)map + STATS_SLOTS);
+  stats->size = size;
+  return 0;
+}
+
+/*
+ * Whether the segment name belongs to a solver which is still running (by the
+ * pid of rank 0, which created it), reporting it to stderr if so. Anything
+ * else there (left by a run which did not exit cleanly, or not a stats
+ * segment at all) is stale.
+ */
+static bool
+stats_live(char const *name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  bool ans = false;
+  struct stat st;
+  size_t size = stats_size(1);
+  if (!fstat(fd, &st) && (size_t)st.st_size >= size) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      struct stats_header *header = map;
+      struct stats_slot *slot = (struct stats_slot *)((char *)map +
+          STATS_SLOTS);
+      pid_t pid = (pid_t)slot->pid;
+      ans = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == STATS_MAGIC
+        && !__atomic_load_n(&header->done, __ATOMIC_ACQUIRE) && pid > 0 &&
+        (!kill(pid, 0) || errno == EPERM);
+      munmap(map, size);
+      if (ans)
+        LOG_ERROR("Could not create %s: %s, used by pid %ld\n", name,
+            strerror(EEXIST), (long)pid);
+    }
+  }
+  close(fd);
+  return ans;
+}
+
+int
+stats_create(struct stats *stats, char const *name, uint32_t ranks, uint64_t
+    iters, double timestep)
+{
+  int ans = 1;
+  memset(stats, 0, sizeof(*stats));
+  if (stats_live(name)) {
+    errno = EEXIST;
+    goto create_return;
+  }
+  /* Whatever else is there was left by a run which did not exit cleanly */
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Could not create %s: %s\n", name, strerror(errno));
+    goto create_return;
+  }
+  size_t size = stats_size(ranks);
+  if (ftruncate(fd, (off_t)size)) {
+    LOG_ERROR("%s: Could not resize: %s\n", name, strerror(errno));
+    goto create_unlink;
+  }
+  if (stats_map(stats, fd, size, PROT_READ | PROT_WRITE, name))
+    goto create_unlink;
+  stats->header->ranks = ranks;
+  stats->header->iters = iters;
+  stats->header->timestep = timestep;
+  stats->slot = stats->slots;
+  stats->slot->pid = (int64_t)getpid();
+  stats->name = name;
+  /* Ranks and viewers check the magic last, so everything else is in place */
+  __atomic_store_n(&stats->header->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+  ans = 0;
+  goto create_fd;
+create_unlink:
+  shm_unlink(name);
+create_fd:
+  close(fd);
+create_return:
+  return ans;
+}
+
+int
+stats_attach(struct stats *stats, char const *name, uint32_t rank)
+{
+  int ans = 1;
+  memset(stats, 0, sizeof(*stats));
+  int fd = shm_open(name, O_RDWR, 0);
+  /* Viewers can still look without asking for residuals */
+  if (fd < 0 && errno == EACCES && rank == UINT32_MAX) {
+    stats->readonly = true;
+    fd = shm_open(name, O_RDONLY, 0);
+  }
+  if (fd < 0) {
+    LOG_ERROR("Could not open %s: %s\n", name, strerror(errno));
+    goto attach_return;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    LOG_ERROR("%s: Could not stat: %s\n", name, strerror(errno));
+    goto attach_fd;
+  }
+  if ((size_t)st.st_size < sizeof(struct stats_header)) {
+    LOG_ERROR("%s: Not a heat stats segment\n", name);
+    goto attach_fd;
+  }
+  bool readonly = stats->readonly;
+  if (stats_map(stats, fd, (size_t)st.st_size, readonly ? PROT_READ :
+        PROT_READ | PROT_WRITE, name))
+    goto attach_fd;
+  stats->readonly = readonly;
+  if (__atomic_load_n(&stats->header->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC
+      || stats_size(stats->header->ranks) != (size_t)st.st_size || (rank !=
+        UINT32_MAX && rank >= stats->header->ranks)) {
+    LOG_ERROR("%s: Not a heat stats segment, or not of rank %u\n", name,
+        rank);
+    munmap(stats->header, stats->size);
+    memset(stats, 0, sizeof(*stats));
+    goto attach_fd;
+  }
+  if (rank != UINT32_MAX) {
+    stats->slot = stats->slots + rank;
+    stats->slot->pid = (int64_t)getpid();
+    stats->asks = __atomic_load_n(&stats->header->asks, __ATOMIC_RELAXED);
+  }
+  ans = 0;
+attach_fd:
+  close(fd);
+attach_return:
+  return ans;
+}
+
+void
+stats_update(struct stats *stats, struct stats_record const *record)
+{
+  struct stats_slot *slot = stats->slot;
+  if (!slot)
+    return;
+  /* The rank is the only writer of its slot */
+  uint64_t seq = slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  /* The odd sequence number has to be visible before any of the record is */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->record = *record;
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool
+stats_asked(struct stats *stats)
+{
+  if (!stats->slot)
+    return false;
+  uint64_t asks = __atomic_load_n(&stats->header->asks, __ATOMIC_RELAXED);
+  if (asks == stats->asks)
+    return false;
+  stats->asks = asks;
+  return true;
+}
+
+int
+stats_ask(struct stats *stats)
+{
+  if (stats->readonly)
+    return 1;
+  __atomic_fetch_add(&stats->header->asks, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+int
+stats_read(struct stats const *stats, uint32_t rank, struct stats_record
+    *record, pid_t *pid)
+{
+  struct stats_slot const *slot = stats->slots + rank;
+  for (unsigned tries = 0; tries < STATS_TRIES; tries++) {
+    uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (!before)
+      return 1;
+    /* Being written, it will not be for long */
+    if (before & 1)
+      continue;
+    *record = slot->record;
+    *pid = (pid_t)slot->pid;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == before)
+      return 0;
+  }
+  return 1;
+}
+
+bool
+stats_done(struct stats const *stats)
+{
+  return __atomic_load_n(&stats->header->done, __ATOMIC_ACQUIRE);
+}
+
+void
+stats_close(struct stats *stats)
+{
+  if (!stats->header)
+    return;
+  if (stats->name) {
+    __atomic_store_n(&stats->header->done, 1, __ATOMIC_RELEASE);
+    shm_unlink(stats->name);
+  }
+  munmap(stats->header, stats->size);
+  memset(stats, 0, sizeof(*stats));
+}
@@ -0,0 +1,130 @@
+#pragma once
+/*
+ * Live metrics of a run over a POSIX shared memory segment, for heatstat to
+ * show while the run goes on. Every rank of the solver (the only one of heat
+ * and seq, each one of par) owns a slot it publishes its record to after
+ * every iteration, guarded by a sequence number (a seqlock) which is odd
+ * while the slot is being written, like the frames of ring.h. Publishing
+ * never waits and is a handful of plain stores, a few nanoseconds, so it is
+ * done every iteration; rates (cells per second) and stalls are left to the
+ * viewers, which compare records taken some time apart.
+ *
+ * The residual takes a pass over the plate, so it is only calculated when a
+ * viewer asks for it (stats_ask), which the solver checks with a single load
+ * per iteration (stats_asked).
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* What a rank publishes */
+struct stats_record {
+  uint64_t iters;
+  /* Points calculated per iteration, and frames in the output buffer out of
+   * how many fit (0 if there is no buffer) */
+  uint64_t cells, buffered, buffer;
+  /* Seconds simulated, and seconds of wall clock stalled writing frames and
+   * waiting for ghost rows */
+  double time, io, halo;
+  /* Max change of a point over the last timestep when last asked, < 0 if it
+   * was never calculated */
+  double residual;
+};
+
+/* Layout of the start of the segment, followed by the slots */
+struct stats_header {
+  uint64_t magic;
+  uint32_t ranks;
+  /* Iterations of the whole run, and seconds each */
+  uint64_t iters;
+  double timestep;
+  /* Set once the solver is done */
+  uint64_t done;
+  /* Times viewers asked for the residual */
+  uint64_t asks;
+};
+
+/*
+ * The record of rank r is in slot r, consistent iff seq is even. Slots are
+ * two cache lines each, aligned on pairs of them, so neighbouring ones (and
+ * the lines prefetched with them) are never written by two ranks.
+ */
+struct stats_slot {
+  uint64_t seq;
+  /* Of the rank, to tell a crashed one from a stalled one */
+  int64_t pid;
+  struct stats_record record;
+  char pad[128 - 2 * sizeof(uint64_t) - sizeof(struct stats_record)];
+};
+
+struct stats {
+  struct stats_header *header;
+  /* Those of every rank, and that of this rank of the solver */
+  struct stats_slot *slots, *slot;
+  size_t size;
+  /* Asks seen by the solver */
+  uint64_t asks;
+  /* Viewers without write access to the segment cannot ask */
+  bool readonly;
+  /* Only set for the rank that created the segment, which removes it */
+  char const *name;
+};
+
+/*
+ * Creates the segment name for a solver of ranks ranks (publishing as rank 0)
+ * running iters iterations of timestep seconds, replacing a stale one left by
+ * a previous run. Returns 0 on success, 1 on error (with errno EEXIST if a
+ * solver still running has the segment), reporting the error to stderr. On
+ * error, nothing is created.
+ */
+int
+stats_create(struct stats *stats, char const *name, uint32_t ranks, uint64_t
+    iters, double timestep);
+
+/*
+ * Attaches to an existing segment to publish as rank (the other ranks of the
+ * solver), or as a viewer if rank is UINT32_MAX. Returns 0 on success, 1 on
+ * error, reporting the error to stderr.
+ */
+int
+stats_attach(struct stats *stats, char const *name, uint32_t rank);
+
+/*
+ * Publishes the record of the rank. Never blocks, does nothing if not created
+ * or attached as a rank.
+ */
+void
+stats_update(struct stats *stats, struct stats_record const *record);
+
+/* Whether a viewer asked for the residual since the last call */
+bool
+stats_asked(struct stats *stats);
+
+/*
+ * Asks every rank for its residual, in the records to come. Returns 0 on
+ * success, 1 if the segment is read only.
+ */
+int
+stats_ask(struct stats *stats);
+
+/*
+ * Copies the latest record of rank into record, and its pid into pid.
+ * Returns 0 on success, 1 if the rank did not publish anything yet (or died
+ * while publishing).
+ */
+int
+stats_read(struct stats const *stats, uint32_t rank, struct stats_record
+    *record, pid_t *pid);
+
+/* Whether the solver is done. */
+bool
+stats_done(struct stats const *stats);
+
+/*
+ * Detaches. The rank that created the segment also marks the run as done and
+ * removes the segment, viewers which are still attached keep their mapping.
+ * Fail-silent.
+ */
+void
+stats_close(struct stats *stats);
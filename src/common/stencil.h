@@ -0,0 +1,144 @@
+#pragma once
+/*
+ * The discretisations of the Laplacian each timestep of the heat equation is
+ * calculated with (forward Euler in time), as a family of row kernels. Each
+ * kernel is generated by STENCIL_ROW from the expression of its stencil (in
+ * libheat.c), so the loop over a row is specialised at compile time for each
+ * stencil, with nothing but arithmetic per point.
+ *
+ *   5   The usual second order 5-point stencil.
+ *   9   The compact 9-point (Mehrstellen) stencil, weighting the diagonals
+ *       1/4 as much as the sides. Second order too, but its error is the
+ *       same in every direction, a multiple of the biharmonic, which with
+ *       alpha = 1/6 cancels the error of forward Euler: the timestep is then
+ *       fourth order in space.
+ *   13  The fourth order 13-point stencil, with the sides and the points two
+ *       away. The error of forward Euler is still second order in space, so
+ *       it only pays off with timesteps well under the largest stable one.
+ *
+ * The points on the edges of the plate never change, as before, so every
+ * stencil but 13 only needs a single ghost point around the points it
+ * calculates (STENCIL_HALO). 13 needs two, which the points next to the edges
+ * do not have: those are calculated with 5 instead, which is stable with any
+ * timestep 13 is.
+ *
+ * With alpha = diffusivity * timestep / spacestep^2, forward Euler is stable
+ * for alpha <= STENCIL_LIMIT. At the limit itself the highest frequency (a
+ * checkerboard) flips sign every timestep without ever decaying, so runs to a
+ * given simulated time (stencil_steps) stay a safety factor under it.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum stencil {
+  STENCIL_5,
+  STENCIL_9,
+  STENCIL_13,
+  STENCILS
+};
+
+static char const *const STENCIL_NAMES[STENCILS] = {"5", "9", "13"};
+
+/* Ghost points needed on each side */
+static size_t const STENCIL_HALO[STENCILS] = {1, 1, 2};
+
+/* Largest stable alpha, 2 over the largest eigenvalue of the stencil */
+static double const STENCIL_LIMIT[STENCILS] = {1 / 4.0, 3 / 8.0, 3 / 16.0};
+
+/* Relative slack for timesteps and times computed in floating point */
+#define STENCIL_SLACK 1e-9
+
+/* The Laplacian at the point c, times spacestep^2, rows p doubles apart */
+#define STENCIL_5(c, p) ((c)[1] + (c)[-1] - 4 * (c)[0] + (c)[p] + (c)[-(p)])
+#define STENCIL_9(c, p) ((4 * ((c)[1] + (c)[-1] + (c)[p] + (c)[-(p)]) +\
+      (c)[(p) + 1] + (c)[(p) - 1] + (c)[-(p) + 1] + (c)[-(p) - 1] - 20 *\
+      (c)[0]) / 6)
+#define STENCIL_13(c, p) ((16 * ((c)[1] + (c)[-1] + (c)[p] + (c)[-(p)]) -\
+      ((c)[2] + (c)[-2] + (c)[2 * (p)] + (c)[-2 * (p)]) - 60 * (c)[0]) / 12)
+
+/*
+ * Defines stencil_row_K, which calculates points [first, last) of a row into
+ * out from in, its previous timestep (rows pitch doubles apart), with the
+ * stencil K. Returns the max of next and of the points calculated.
+ */
+#define STENCIL_ROW(K)\
+  static inline double\
+  stencil_row_##K(double *out, double const *in, size_t first, size_t last,\
+      ptrdiff_t pitch, double alpha, double next)\
+  {\
+    for (size_t j = first; j < last; j++) {\
+      double const *c = in + j;\
+      out[j] = c[0] + alpha * STENCIL_##K(c, pitch);\
+      if (out[j] > next)\
+        next = out[j];\
+    }\
+    return next;\
+  }
+
+/* Returns the stencil called name, or STENCILS if there is none */
+static inline enum stencil
+stencil_parse(char const *name)
+{
+  int s = 0;
+  while (s < STENCILS && strcmp(name, STENCIL_NAMES[s]))
+    s++;
+  return (enum stencil)s;
+}
+
+/* Whether alpha is stable with stencil */
+static inline bool
+stencil_stable(enum stencil stencil, double alpha)
+{
+  return alpha <= STENCIL_LIMIT[stencil] * (1 + STENCIL_SLACK);
+}
+
+static inline uint64_t
+stencil_gcd(uint64_t a, uint64_t b)
+{
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/*
+ * Splits until seconds into equal timesteps of at most timestep seconds,
+ * returning how many, so the last one ends exactly at until. For each of the
+ * n cadences every[k] > 0 (seconds), strides[k] is set to the timesteps
+ * between samples: exactly every[k] seconds if it divides until (the number
+ * of timesteps is made a multiple of until / every[k]), otherwise as close as
+ * possible. Cadences <= 0 leave their stride alone.
+ */
+static inline uint64_t
+stencil_steps(double until, double timestep, double const *every,
+    uint64_t *strides, size_t n)
+{
+  /* Every whole cadence has to split the timesteps evenly */
+  uint64_t multiple = 1;
+  for (size_t k = 0; k < n; k++) {
+    if (every[k] <= 0)
+      continue;
+    double q = until / every[k];
+    uint64_t samples = (uint64_t)(q + 0.5);
+    if (samples && q - (double)samples <= q * STENCIL_SLACK &&
+        (double)samples - q <= q * STENCIL_SLACK)
+      multiple = multiple / stencil_gcd(multiple, samples) * samples;
+  }
+  double q = until / timestep;
+  uint64_t steps = (uint64_t)q;
+  if (q - (double)steps > q * STENCIL_SLACK || !steps)
+    steps++;
+  steps = (steps + multiple - 1) / multiple * multiple;
+  for (size_t k = 0; k < n; k++) {
+    if (every[k] <= 0)
+      continue;
+    strides[k] = (uint64_t)(every[k] / (until / (double)steps) + 0.5);
+    if (!strides[k])
+      strides[k] = 1;
+  }
+  return steps;
+}
@@ -12,15 +12,46 @@ static char const ARGP_DOC[] = "Calculates the heat equation on a 2D surface, "
   "outputting the result to stdout";
 static char const ARGP_DOCA[] = " ";
 static struct argp_option const ARGP_OPT[] = {
-  {"time", 't', NULL, OPTION_ARG_OPTIONAL, "Output a elapsed time to stdout.", 0},
+  {"time", 't', NULL, OPTION_ARG_OPTIONAL, "Output the elapsed time of each "
+    "rank to stdout, split in computing, waiting for halos and outputting "
+    "frames.", 0},
   {"output", 'o', NULL, OPTION_ARG_OPTIONAL, "Output a .pgm to stdout.", 0},
+  {"live", 'l', "NAME", 0, "Publish frames to the shared memory ring buffer "
+    "NAME (e.g. /heat) for display --live instead of writing heat.bin.", 0},
+  {"stats", 'M', "NAME", 0, "Publish live metrics of every rank to the shared "
+    "memory segment NAME (e.g. /heatstat) for heatstat while running.", 0},
+  {"levels", 'L', "LEVELS", 0, "Also output LEVELS downsampled levels (2x, "
+    "4x, ...) of each iteration to heat.lK.bin (block means), heat.lK.min.bin "
+    "and heat.lK.max.bin. Default 0.", 0},
   {"resolution", 'n', "UNITS", 0, "The surface is the unit square, to be "
     "represented by a nxn matrix. Default: 100.", 0},
+  {"stencil", 'S', "POINTS", 0, "Discretise with the POINTS-point stencil: 5 "
+    "(second order), 9 (compact, isotropic second order) or 13 (fourth order, "
+    "seq only). Default 5.", 0},
   {"iterations", 'i', "ITERS", 0, "Number of iterations. Default is 3000.", 0},
+  {"until", 'u', "SECONDS", 0, "Run until SECONDS of simulated time instead "
+    "of -i iterations, in equal timesteps of at most -s (or the largest "
+    "stable one times -x).", 0},
+  {"safety", 'x', "FRACTION", 0, "Fraction of the largest stable timestep "
+    "taken by default (only applicable if called with -u). Default 0.9.", 0},
+  {"frame-stride", 'f', "ITERS", 0, "Output a frame every ITERS iterations. "
+    "Default 1.", 0},
+  {"frame-time", 'F', "SECONDS", 0, "Output a frame every SECONDS of "
+    "simulated time instead of every -f iterations (only applicable if called "
+    "with -u).", 0},
+  {"parareal", 'P', "SLICES", 0, "Parallel in time too (see parareal.h): "
+    "split the iterations in SLICES slices, each calculated by its share of "
+    "the ranks at once, and output the plate at the end of each instead of "
+    "every -f iterations. Default 0 (off).", 0},
+  {"coarsen", 'c', "POINTS", 0, "Spacing of the coarse grid of -P, in points "
+    "of the plate. Default 4.", 0},
+  {"tolerance", 'e', "KELVIN", 0, "Stop -P once no slice changes by more than "
+    "KELVIN in an iteration. Default 0, exactly as without -P.", 0},
   {"spacestep", 'p', "METERS", 0, "Spacestep in meters. Default 1/(n+2).", 0},
   {"diffusivity", 'd', "J/ M3 K", 0, "Diffusivity in J/M3 K. Default is 0.1.", 0},
-  {"timestep", 's', "SECONDS", 0, "Timestep in seconds. Default spacestep2 / "
-    "(4 diffusivity).", 0},
+  {"timestep", 's', "SECONDS", 0, "Timestep in seconds. Default the largest "
+    "stable one, spacestep2 / (4 diffusivity) with the 5-point stencil. "
+    "Unstable ones are warned about, or refused with -u.", 0},
   { 0 }
 };
 
@@ -30,8 +61,11 @@ struct argp_arguments {
 #else
   char *input[ARGP_MAX_ARGS];
 #endif
-  int n, iters;
+  int n, iters, frame_stride, slices, coarsen;
+  unsigned levels;
   double timestep, spacestep, diffusivity;
+  double until, safety, frame_time, tolerance;
+  char *live, *stencil, *stats;
   bool output, time;
 };
 
@@ -59,6 +93,19 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
     case 't':
       arguments->time = true;
       break;
+    case 'l':
+      arguments->live = arg;
+      break;
+    case 'S':
+      arguments->stencil = arg;
+      break;
+    case 'M':
+      arguments->stats = arg;
+      break;
+    case 'L':
+      arguments->levels = (unsigned)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
     case 's':
       arguments->timestep = strtod(arg, &endptr);
       ASSERTSTRTO(arg, endptr);
@@ -75,6 +122,48 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
       arguments->n = (int)strtol(arg, &endptr, 10);
       ASSERTSTRTO(arg, endptr);
       break;
+    case 'u':
+      arguments->until = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->until > 0))
+        argp_error(state, "The simulated time should be > 0");
+      break;
+    case 'x':
+      arguments->safety = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->safety > 0 && arguments->safety <= 1))
+        argp_error(state, "The safety factor should be in (0, 1]");
+      break;
+    case 'f':
+      arguments->frame_stride = (int)strtol(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (arguments->frame_stride < 1)
+        argp_error(state, "The frame stride should be > 0");
+      break;
+    case 'F':
+      arguments->frame_time = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->frame_time > 0))
+        argp_error(state, "The frame time should be > 0");
+      break;
+    case 'P':
+      arguments->slices = (int)strtol(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (arguments->slices < 1)
+        argp_error(state, "The slices should be > 0");
+      break;
+    case 'c':
+      arguments->coarsen = (int)strtol(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (arguments->coarsen < 1)
+        argp_error(state, "The coarse grid spacing should be > 0");
+      break;
+    case 'e':
+      arguments->tolerance = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->tolerance >= 0))
+        argp_error(state, "The tolerance should be >= 0");
+      break;
     case 'i':
       arguments->iters = (int)strtol(arg, &endptr, 10);
       ASSERTSTRTO(arg, endptr);
@@ -14,6 +14,18 @@ static char const ARGP_DOCA[] = "SIZE ITERS";
 static struct argp_option const ARGP_OPT[] = {
   {"simple", 's', NULL, OPTION_ARG_OPTIONAL, "Use a 2-color heatmap instead of "
     "the standard 5-color one.", 0},
+  {"fps", 'f', "FPS", 0, "Playback frame rate. Frames are skipped if rendering "
+    "falls behind. Default 0 (as fast as possible).", 0},
+  {"start", 'j', "FRAME", 0, "Start at this frame. Default 0.", 0},
+  {"cache", 'c', "FRAMES", 0, "Number of frames to pre-render ahead. Default "
+    "8.", 0},
+  {"level", 'L', "LEVEL", 0, "Show the downsampled level LEVEL (see heat "
+    "--levels) instead of the full resolution. Default 0.", 0},
+  {"plane", 'P', "PLANE", 0, "With --level, show the mean, min or max of each "
+    "downsampled block. Default mean.", 0},
+  {"live", 'l', "NAME", 0, "Show the latest frame of a heat running with "
+    "--live=NAME instead of reading heat.bin. SIZE and ITERS are not needed.",
+    0},
   { 0 }
 };
 
@@ -21,7 +33,9 @@ struct argp_arguments {
 #if ARGP_ARGS > 0
   char *input[ARGP_ARGS];
 #endif
-  uint32_t n, iters, input_size;
+  uint32_t n, iters, input_size, start, cache, level;
+  double fps;
+  char *live, *plane;
   bool simple;
 };
 
@@ -45,6 +59,30 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
     case 's':
       arguments->simple = true;
       break;
+    case 'f':
+      arguments->fps = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'j':
+      arguments->start = (uint32_t)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'c':
+      arguments->cache = (uint32_t)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'l':
+      arguments->live = arg;
+      break;
+    case 'L':
+      arguments->level = (uint32_t)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'P':
+      if (strcmp(arg, "mean") && strcmp(arg, "min") && strcmp(arg, "max"))
+        argp_error(state, "PLANE should be mean, min or max");
+      arguments->plane = arg;
+      break;
     case ARGP_KEY_ARG:
 			switch(arguments->input_size) {
         case 0:
@@ -61,7 +99,7 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
 			arguments->input_size++;
 			break;
 		case ARGP_KEY_END:
-			if (state->arg_num < ARGP_ARGS)
+			if (state->arg_num < ARGP_ARGS && !arguments->live)
 				argp_usage(state);
 			break;
 		default:
@@ -8,15 +8,175 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include "frames.h"
 #include "graphics.h"
+#include "ring.h"
 #include <stddef.h>
 
+/* Marks a cache slot which holds no frame (or one being rendered) */
+#define NOFRAME UINT64_MAX
+
+/*
+ * Pre-rendered frames. A background thread keeps the frames [want, want +
+ * slots) rendered, frame f going to slot f % slots, so playback only has to
+ * present them. The slot of want is never touched by the thread once it holds
+ * want, which is what allows presenting it without holding the lock.
+ */
+struct cache {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct frames const *frames;
+  uint8_t *pixels;
+  uint64_t *frame;
+  uint64_t want, count;
+  uint32_t slots;
+  bool simple, quit;
+};
+
+static uint8_t *
+slot(struct cache const *cache, uint64_t f)
+{
+  return cache->pixels + (size_t)(f % cache->slots) *
+    GRAPHICS_PIXELS(cache->frames->n);
+}
+
+static void *
+prefetch(void *arg)
+{
+  struct cache *cache = (struct cache *)arg;
+  pthread_mutex_lock(&cache->lock);
+  while (!cache->quit) {
+    uint64_t f = cache->want;
+    uint64_t end = cache->count - f < cache->slots ? cache->count : f +
+      cache->slots;
+    while (f < end && cache->frame[f % cache->slots] == f)
+      f++;
+    if (f == end) {
+      pthread_cond_wait(&cache->cond, &cache->lock);
+      continue;
+    }
+    cache->frame[f % cache->slots] = NOFRAME;
+    pthread_mutex_unlock(&cache->lock);
+    /* Have the kernel read the next frame in while we render this one */
+    frames_prefetch(cache->frames, f + 1, 1);
+    double const *surface = frames_get(cache->frames, f);
+    if (cache->simple)
+      graphics_render2(slot(cache, f), surface, cache->frames->n);
+    else
+      graphics_render5(slot(cache, f), surface, cache->frames->n);
+    pthread_mutex_lock(&cache->lock);
+    cache->frame[f % cache->slots] = f;
+    pthread_cond_broadcast(&cache->cond);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return NULL;
+}
+
+/* Moves the cache window to f and waits until f is rendered */
+static uint8_t const *
+wait_frame(struct cache *cache, uint64_t f)
+{
+  pthread_mutex_lock(&cache->lock);
+  if (cache->want != f) {
+    cache->want = f;
+    pthread_cond_broadcast(&cache->cond);
+  }
+  while (cache->frame[f % cache->slots] != f)
+    pthread_cond_wait(&cache->cond, &cache->lock);
+  pthread_mutex_unlock(&cache->lock);
+  return slot(cache, f);
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Shows the latest frame published by a heat running with --live until the
+ * user quits, at most fps times a second. Whatever the solver publishes while
+ * we are busy rendering is dropped, the solver never waits for us.
+ */
+static int
+live(struct argp_arguments const *args)
+{
+  int ans = EXIT_FAILURE;
+  struct ring ring;
+  if (ring_attach(&ring, args->live))
+    goto live_return;
+  uint32_t n = ring.header->n;
+  double *surface = malloc((size_t)n * n * sizeof(*surface));
+  if (!surface) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto live_ring;
+  }
+  uint8_t *pixels = malloc(GRAPHICS_PIXELS(n));
+  if (!pixels) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto live_surface;
+  }
+  graphics_init(n);
+  uint32_t timeout = args->fps > 0 ? (uint32_t)(1000 / args->fps) : 10;
+  /* Over 1000 fps, polling without waiting would spin on a core */
+  if (!timeout)
+    timeout = 1;
+  uint64_t seen = 0;
+  bool paused = false, done = false;
+  for (;;) {
+    bool dirty = false;
+    switch (graphics_poll(timeout)) {
+      case GRAPHICS_QUIT:
+        goto live_success;
+      case GRAPHICS_TOGGLE:
+        paused = !paused;
+        break;
+      case GRAPHICS_REDRAW:
+        dirty = seen > 0;
+        break;
+      default:
+        break;
+    }
+    if (!paused && !ring_latest(&ring, surface, &seen)) {
+      if (args->simple)
+        graphics_render2(pixels, surface, n);
+      else
+        graphics_render5(pixels, surface, n);
+      dirty = true;
+    } else if (!done && ring_done(&ring)) {
+      LOG_INFO("%s: Solver is done\n", args->live);
+      done = true;
+    }
+    if (dirty && graphics_present(pixels, n))
+      goto live_graphics;
+  }
+live_success:
+  ans = EXIT_SUCCESS;
+live_graphics:
+  graphics_end();
+  free(pixels);
+live_surface:
+  free(surface);
+live_ring:
+  ring_close(&ring);
+live_return:
+  return ans;
+}
+
 int
 main(int argc, char **argv)
 {
+  int ans = EXIT_FAILURE;
   struct argp_arguments args;
   memset(&args, 0, sizeof(args));
   args.simple = false;
+  args.fps = 0.0;
+  args.start = 0;
+  args.cache = 8;
   struct argp argp = {
     ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
   };
@@ -25,35 +185,159 @@ main(int argc, char **argv)
     fprintf(stderr, "%s, error while parsing parameters\n", argv[0]);
     return EXIT_FAILURE;
   }
-  double **surface = malloc((size_t)args.n * sizeof(*surface));
-  if (!surface)
-    exit(errno);
-  for (uint32_t i = 0; i < args.n; i++) {
-    surface[i] = malloc((size_t)args.n * sizeof(*(surface[i])));
-    if (!surface[i])
-      exit(errno);
+  if (args.live)
+    return live(&args);
+  if (!args.cache) {
+    LOG_CRITICAL("Cache should hold at least one frame\n");
+    return EXIT_FAILURE;
+  }
+  /* Levels are written by heat --levels next to heat.bin */
+  char path[64] = "heat.bin";
+  if (args.level) {
+    if (args.level >= 32) {
+      LOG_CRITICAL("Level %"PRIu32" is too deep\n", args.level);
+      return EXIT_FAILURE;
+    }
+    bool mean = !args.plane || !strcmp(args.plane, "mean");
+    snprintf(path, sizeof(path), "heat.l%"PRIu32"%s%s.bin", args.level,
+        mean ? "" : ".", mean ? "" : args.plane);
+    args.n = (uint32_t)(((uint64_t)args.n + (1u << args.level) - 1) >>
+        args.level);
+  }
+  struct frames frames;
+  if (frames_open(&frames, path, args.n))
+    return EXIT_FAILURE;
+  struct cache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.frames = &frames;
+  cache.count = frames.count;
+  if (args.iters < cache.count)
+    cache.count = args.iters;
+  else if (args.iters > cache.count)
+    LOG_WARNING("%s only has %"PRIu64" frames\n", path, cache.count);
+  if (!cache.count)
+    goto main_frames;
+  if (args.start >= cache.count) {
+    LOG_CRITICAL("Start frame %"PRIu32" is past the last frame (%"PRIu64")\n",
+        args.start, cache.count - 1);
+    goto main_frames;
+  }
+  cache.slots = args.cache;
+  cache.simple = args.simple;
+  cache.want = args.start;
+  cache.pixels = malloc(cache.slots * GRAPHICS_PIXELS(args.n));
+  if (!cache.pixels) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_frames;
   }
+  cache.frame = malloc(cache.slots * sizeof(*cache.frame));
+  if (!cache.frame) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_pixels;
+  }
+  for (uint32_t i = 0; i < cache.slots; i++)
+    cache.frame[i] = NOFRAME;
+  pthread_mutex_init(&cache.lock, NULL);
+  pthread_cond_init(&cache.cond, NULL);
   graphics_init(args.n);
-  FILE *f = fopen("heat.bin", "r");
-  if (!f) {
-    LOG_CRITICAL("Could not open heat.bin: %s\n", strerror(errno));
-    exit(errno);
-  }
-  uint32_t iter = 0;
-  while (iter < args.iters) {
-    for (uint32_t i = 0; i < args.n; i++)
-      if (fread(surface[i], sizeof(surface[0][0]), args.n, f) != args.n) {
-        LOG_CRITICAL("Could not read line %"PRIu32" iter %"PRIu32": %s\n", i, iter, strerror(errno));
-        exit(errno);
-      }
-    if (args.simple)
-			graphics_draw2(surface, args.n);
-		else
-			graphics_draw5(surface, args.n);
-    iter++;
-  }
-  fclose(f);
+  pthread_t prefetcher;
+  int rc = pthread_create(&prefetcher, NULL, prefetch, &cache);
+  if (rc) {
+    LOG_CRITICAL("Could not start the prefetcher: %s\n", strerror(rc));
+    goto main_frame;
+  }
+  /* Playback position and the clock it is measured against */
+  uint64_t cur = args.start, origin = cur, skipped = 0;
+  double t0 = now();
+  bool playing = true, dirty = true;
+  for (;;) {
+    if (dirty) {
+      if (graphics_present(wait_frame(&cache, cur), args.n))
+        goto main_graphics;
+      dirty = false;
+    }
+    uint32_t timeout = 100;
+    if (playing && args.fps > 0) {
+      double wait = t0 + (double)(cur + 1 - origin) / args.fps - now();
+      timeout = wait > 0 ? (uint32_t)(wait * 1000) : 0;
+    } else if (playing) {
+      timeout = 0;
+    }
+    enum graphics_event event = graphics_poll(timeout);
+    uint64_t prev = cur;
+    switch (event) {
+      case GRAPHICS_QUIT:
+        goto main_success;
+      case GRAPHICS_REDRAW:
+        dirty = true;
+        break;
+      case GRAPHICS_TOGGLE:
+        playing = !playing;
+        break;
+      case GRAPHICS_NEXT:
+        playing = false;
+        cur += cur + 1 < cache.count;
+        break;
+      case GRAPHICS_PREV:
+        playing = false;
+        cur -= cur > 0;
+        break;
+      case GRAPHICS_FORWARD:
+        cur = cache.count - cur > GRAPHICS_SEEK ? cur + GRAPHICS_SEEK :
+          cache.count - 1;
+        break;
+      case GRAPHICS_BACKWARD:
+        cur = cur > GRAPHICS_SEEK ? cur - GRAPHICS_SEEK : 0;
+        break;
+      case GRAPHICS_FIRST:
+        cur = 0;
+        break;
+      case GRAPHICS_LAST:
+        cur = cache.count - 1;
+        break;
+      case GRAPHICS_NONE:
+        if (!playing)
+          break;
+        if (args.fps > 0) {
+          /* Jump to whatever frame is due, skipping if we fell behind */
+          uint64_t due = origin + (uint64_t)((now() - t0) * args.fps);
+          if (due > cur + 1)
+            skipped += due - cur - 1;
+          if (due > cur)
+            cur = due < cache.count ? due : cache.count - 1;
+        } else {
+          cur += cur + 1 < cache.count;
+        }
+        break;
+    }
+    if (event != GRAPHICS_NONE && event != GRAPHICS_REDRAW) {
+      origin = cur;
+      t0 = now();
+    }
+    /* Stay on the last frame once playback reaches it */
+    if (cur == cache.count - 1)
+      playing = false;
+    dirty = dirty || cur != prev;
+  }
+main_success:
+  if (skipped)
+    LOG_INFO("Skipped %"PRIu64" frames to keep up with %g fps\n", skipped,
+        args.fps);
+  ans = EXIT_SUCCESS;
+main_graphics:
+  pthread_mutex_lock(&cache.lock);
+  cache.quit = true;
+  pthread_cond_broadcast(&cache.cond);
+  pthread_mutex_unlock(&cache.lock);
+  pthread_join(prefetcher, NULL);
+main_frame:
   graphics_end();
-  free(surface);
-  return 0;
+  pthread_cond_destroy(&cache.cond);
+  pthread_mutex_destroy(&cache.lock);
+  free(cache.frame);
+main_pixels:
+  free(cache.pixels);
+main_frames:
+  frames_close(&frames);
+  return ans;
 }
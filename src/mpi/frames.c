@@ -0,0 +1,91 @@
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "frames.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t
+frame_size(uint32_t n)
+{
+  return (size_t)n * n * sizeof(double);
+}
+
+int
+frames_open(struct frames *frames, char const *path, uint32_t n)
+{
+  int ans = 1;
+  memset(frames, 0, sizeof(*frames));
+  if (!n) {
+    LOG_ERROR("Frame size should be > 0\n");
+    goto open_return;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR("Could not open %s: %s\n", path, strerror(errno));
+    goto open_return;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    LOG_ERROR("%s: Could not stat: %s\n", path, strerror(errno));
+    goto open_fd;
+  }
+  frames->count = (uint64_t)st.st_size / frame_size(n);
+  if (!frames->count) {
+    LOG_ERROR("%s: Does not hold a single %"PRIu32"x%"PRIu32" frame\n", path,
+        n, n);
+    goto open_fd;
+  }
+  if ((uint64_t)st.st_size % frame_size(n))
+    LOG_WARNING("%s: Ignoring trailing partial frame\n", path);
+  frames->size = (size_t)(frames->count * frame_size(n));
+  void *map = mmap(NULL, frames->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERROR("%s: Could not mmap: %s\n", path, strerror(errno));
+    goto open_fd;
+  }
+  /* We jump around the file, don't let the kernel read ahead blindly */
+  posix_madvise(map, frames->size, POSIX_MADV_RANDOM);
+  frames->data = map;
+  frames->n = n;
+  ans = 0;
+open_fd:
+  /* The mapping keeps its own reference to the file */
+  close(fd);
+open_return:
+  return ans;
+}
+
+double const *
+frames_get(struct frames const *frames, uint64_t i)
+{
+  return frames->data + (size_t)i * frames->n * frames->n;
+}
+
+void
+frames_prefetch(struct frames const *frames, uint64_t i, uint64_t count)
+{
+  if (i >= frames->count)
+    return;
+  if (count > frames->count - i)
+    count = frames->count - i;
+  /* madvise wants a page aligned address */
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)frames_get(frames, i);
+  uintptr_t aligned = start & ~(page - 1);
+  size_t len = count * frame_size(frames->n) + (size_t)(start - aligned);
+  posix_madvise((void *)aligned, len, POSIX_MADV_WILLNEED);
+}
+
+void
+frames_close(struct frames *frames)
+{
+  if (frames->data)
+    munmap((void *)frames->data, frames->size);
+  memset(frames, 0, sizeof(*frames));
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Random-access reader for the heat.bin written by par.c and seq.c. The file
+ * has no header, it is just a sequence of nxn double matrices, so the frame
+ * index is the file size divided by the frame size and frame i lives at byte
+ * i * n * n * sizeof(double). The whole file is mmapped read-only, so reading
+ * frame 50000 does not touch the 49999 frames before it.
+ */
+struct frames {
+  double const *data;
+  size_t size;
+  uint64_t count;
+  uint32_t n;
+};
+
+/*
+ * Maps path, which should hold nxn frames. Returns 0 on success, 1 on error,
+ * reporting the error to stderr. On error, nothing is mapped.
+ */
+int
+frames_open(struct frames *frames, char const *path, uint32_t n);
+
+/* Returns frame i, which must be < frames->count. */
+double const *
+frames_get(struct frames const *frames, uint64_t i);
+
+/*
+ * Hints the kernel that frames [i, i + count) will be needed soon, clamped to
+ * the frames in the file. Fail-silent.
+ */
+void
+frames_prefetch(struct frames const *frames, uint64_t i, uint64_t count);
+
+/* Unmaps the file. Fail-silent. */
+void
+frames_close(struct frames *frames);
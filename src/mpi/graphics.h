@@ -1,18 +1,64 @@
 #pragma once
 #include <stdint.h>
 
-/* Initializes the graphics environment. On failure, don't init anything. */
+/* User input, as reported by graphics_poll */
+enum graphics_event {
+  GRAPHICS_NONE,
+  GRAPHICS_QUIT,
+  /* The window changed, present the frame again */
+  GRAPHICS_REDRAW,
+  /* Play/pause */
+  GRAPHICS_TOGGLE,
+  /* Step one frame */
+  GRAPHICS_NEXT,
+  GRAPHICS_PREV,
+  /* Seek GRAPHICS_SEEK frames */
+  GRAPHICS_FORWARD,
+  GRAPHICS_BACKWARD,
+  GRAPHICS_FIRST,
+  GRAPHICS_LAST
+};
+
+#define GRAPHICS_SEEK 100
+
+/* Size in bytes of the pixel buffer for a nxn surface. */
+#define GRAPHICS_PIXELS(n) ((size_t)(n) * (n) * 3)
+
+/*
+ * Initializes the graphics environment. On failure, don't init anything. Must
+ * be called before rendering.
+ */
 void
 graphics_init(uint32_t n);
 
-/* Draws the surface using a 5-color heatmap. Returns 0 on success, 1 on failure. */
-int
-graphics_draw5(double **surface, uint32_t n);
+/*
+ * Renders the nxn surface to pixels (GRAPHICS_PIXELS(n) bytes) using a 5-color
+ * heatmap, scaled to the max temperature of the frame. Does not touch the
+ * graphics environment, so it is safe to call from any thread.
+ */
+void
+graphics_render5(uint8_t *pixels, double const *surface, uint32_t n);
+
+/*
+ * Same as graphics_render5 but with a 2-color heatmap, scaled to the min and
+ * max temperatures of the frame.
+ */
+void
+graphics_render2(uint8_t *pixels, double const *surface, uint32_t n);
 
-/* Draws the surface using a 2-color heatmap. Returns 0 on success, 1 on failure. */
+/*
+ * Draws pixels rendered by one of the above, scaled to fit the window. Returns
+ * 0 on success, 1 on failure.
+ */
 int
-graphics_draw2(double **surface, uint32_t n);
+graphics_present(uint8_t const *pixels, uint32_t n);
 
+/*
+ * Waits up to timeout ms for user input and returns it, or GRAPHICS_NONE if
+ * there was none.
+ */
+enum graphics_event
+graphics_poll(uint32_t timeout);
 
 /* Ends the graphics environment. Fail-silent. */
 void
@@ -5,74 +5,181 @@
 #include <assert.h>
 #include <SDL.h>
 #include <stdint.h>
-#include "shared.c"
 
 static SDL_Window *WINDOW = NULL;
 static SDL_Renderer *RENDERER = NULL;
+/* Streaming nxn texture every frame is uploaded to */
+static SDL_Texture *TEXTURE = NULL;
+
+/*
+ * Color lookup tables, indexed by the position of a point in the gradient
+ * scaled to [0, LUT_SIZE - 1]. Filled by graphics_init.
+ */
+#define LUT_SIZE 1024
+static uint8_t LUT5[LUT_SIZE][3];
+static uint8_t LUT2[LUT_SIZE][3];
+
+struct RGB {
+  uint8_t r, g, b;
+  double val;
+};
+
+static void
+lut_init(void)
+{
+  // Cooler
+  struct RGB blue = { 0, 0, 255, 0.0};
+  struct RGB cyan = { 0, 255, 255, 0.25};
+  struct RGB green = { 0, 255, 0, 0.5};
+  struct RGB yellow = { 255, 255, 0, 0.75};
+  struct RGB red = { 255, 0, 0, 1.0};
+  // Hotter
+  struct RGB heatmap[5] = { blue, cyan, green, yellow, red };
+  for (size_t i = 0; i < LUT_SIZE; i++) {
+    // Scale the point to a position in the gradiend
+    double p = (double)i / (LUT_SIZE - 1);
+    uint8_t r = red.r, g = red.g, b = red.b;
+    for (uint8_t k = 0; k < 5; k++)
+      if (p < heatmap[k].val) {
+        struct RGB *prev = heatmap + (k - 1 < 0 ? 0 : k - 1);
+        double vdiff = prev->val - heatmap[k].val;
+        double diff = vdiff ? (p - heatmap[k].val) / vdiff : 0.0;
+        r = (uint8_t)((prev->r - heatmap[k].r) * diff + heatmap[k].r);
+        g = (uint8_t)((prev->g - heatmap[k].g) * diff + heatmap[k].g);
+        b = (uint8_t)((prev->b - heatmap[k].b) * diff + heatmap[k].b);
+        break;
+      }
+    LUT5[i][0] = r;
+    LUT5[i][1] = g;
+    LUT5[i][2] = b;
+    LUT2[i][0] = (uint8_t)(255 * p);
+    LUT2[i][1] = 0;
+    LUT2[i][2] = (uint8_t)(255 * (1 - p));
+  }
+}
 
 void
 graphics_init(uint32_t n)
 {
   assert(!WINDOW && !RENDERER);
+  lut_init();
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     LOG_CRITICAL("On init: %s\n", SDL_GetError());
     goto init;
   }
-  SDL_CreateWindowAndRenderer(n, n, 0, &WINDOW, &RENDERER);
-  if (!WINDOW || !RENDERER) {
+  /* Large surfaces are scaled down to fit the screen, smooth them out */
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+  int size = (int)n;
+  SDL_DisplayMode mode;
+  if (!SDL_GetDesktopDisplayMode(0, &mode)) {
+    int fit = (mode.w < mode.h ? mode.w : mode.h) * 9 / 10;
+    if (size > fit)
+      size = fit;
+  }
+  WINDOW = SDL_CreateWindow("heat", SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED, size, size, SDL_WINDOW_RESIZABLE |
+      SDL_WINDOW_ALLOW_HIGHDPI);
+  if (!WINDOW) {
     LOG_CRITICAL("On window creation: %s\n", SDL_GetError());
     goto init;
   }
+  RENDERER = SDL_CreateRenderer(WINDOW, -1, SDL_RENDERER_ACCELERATED);
+  if (!RENDERER) {
+    LOG_CRITICAL("On renderer creation: %s\n", SDL_GetError());
+    goto init_window;
+  }
+  TEXTURE = SDL_CreateTexture(RENDERER, SDL_PIXELFORMAT_RGB24,
+      SDL_TEXTUREACCESS_STREAMING, (int)n, (int)n);
+  if (!TEXTURE) {
+    LOG_CRITICAL("On texture creation: %s\n", SDL_GetError());
+    goto init_renderer;
+  }
   goto success;
+init_renderer:
+  SDL_DestroyRenderer(RENDERER);
+  RENDERER = NULL;
+init_window:
+  SDL_DestroyWindow(WINDOW);
+  WINDOW = NULL;
 init:
   SDL_Quit();
 success:
   return;
 }
 
-struct RGB {
-  uint8_t r, g, b;
-  double val;
-};
-
-int
-graphics_draw2(double **surface, uint32_t n)
+/* Min and max temperatures in the nxn surface */
+static void
+range(double const *surface, uint32_t n, double *lo, double *hi)
 {
-  if (SDL_SetRenderDrawColor(RENDERER, 0, 0, 0, SDL_ALPHA_OPAQUE)) {
-    LOG_ERROR("While setting the renderer color: %s\n", SDL_GetError());
-    return 1;
+  double mn = surface[0], mx = surface[0];
+  long long total = (long long)n * n;
+#pragma omp parallel for reduction(min:mn) reduction(max:mx)
+  for (long long i = 1; i < total; i++) {
+    if (surface[i] < mn)
+      mn = surface[i];
+    if (surface[i] > mx)
+      mx = surface[i];
   }
-  if (SDL_RenderClear(RENDERER)) {
-    LOG_ERROR("While clearing the renderer: %s\n", SDL_GetError());
-    return 1;
-  }
-  double mval = 10.0;//max(surface, n);
-  //mval = mval <= 0 ? 1 : mval;
-  for (uint32_t i = 0; i < n; i++) {
-    for (uint32_t j = 0; j < n; j++) {
-      double p = surface[i][j] / mval;
-      uint8_t red = (uint8_t)(255 * p);
-      uint8_t blue = (uint8_t)(255 * (1 - p));
-      if (SDL_SetRenderDrawColor(RENDERER, red, 0, blue, SDL_ALPHA_OPAQUE)) {
-        //if (SDL_SetRenderDrawColor(RENDERER, p, p, p, SDL_ALPHA_OPAQUE)) {
-        LOG_ERROR("While drawing color with: %s\n", SDL_GetError());
-        return 1;
-      }
-      if (SDL_RenderDrawPoint(RENDERER, j, i) < 0) {
-        LOG_ERROR("While drawing point %"PRIu32" %"PRIu32": %s\n", i, j,
-            SDL_GetError());
-        return 1;
-      }
-    }
+  *lo = mn;
+  *hi = mx;
+}
+
+/* Max temperature in the nxn surface */
+static double
+peak(double const *surface, uint32_t n)
+{
+  double mx = surface[0];
+  long long total = (long long)n * n;
+#pragma omp parallel for reduction(max:mx)
+  for (long long i = 1; i < total; i++)
+    if (surface[i] > mx)
+      mx = surface[i];
+  return mx;
+}
+
+/*
+ * Maps every point of the nxn surface, scaled by (p - lo) / (hi - lo), through
+ * lut into pixels.
+ */
+static void
+render(uint8_t *pixels, double const *surface, uint32_t n,
+    uint8_t (*lut)[3], double lo, double hi)
+{
+  double scale = hi > lo ? (LUT_SIZE - 1) / (hi - lo) : 0.0;
+  long long total = (long long)n * n;
+#pragma omp parallel for schedule(static)
+  for (long long i = 0; i < total; i++) {
+    double p = (surface[i] - lo) * scale;
+    size_t k = p <= 0 ? 0 : p >= LUT_SIZE - 1 ? LUT_SIZE - 1 : (size_t)p;
+    pixels[3 * i] = lut[k][0];
+    pixels[3 * i + 1] = lut[k][1];
+    pixels[3 * i + 2] = lut[k][2];
   }
-  SDL_RenderPresent(RENDERER);
-  return 0;
 }
 
+void
+graphics_render2(uint8_t *pixels, double const *surface, uint32_t n)
+{
+  double lo, hi;
+  range(surface, n, &lo, &hi);
+  render(pixels, surface, n, LUT2, lo, hi);
+}
+
+void
+graphics_render5(uint8_t *pixels, double const *surface, uint32_t n)
+{
+  double mval = peak(surface, n);
+  mval = mval <= 0 ? 1 : mval;
+  render(pixels, surface, n, LUT5, 0.0, mval);
+}
 
 int
-graphics_draw5(double **surface, uint32_t n)
+graphics_present(uint8_t const *pixels, uint32_t n)
 {
+  if (SDL_UpdateTexture(TEXTURE, NULL, pixels, (int)(3 * n))) {
+    LOG_ERROR("While uploading the frame: %s\n", SDL_GetError());
+    return 1;
+  }
   if (SDL_SetRenderDrawColor(RENDERER, 0, 0, 0, SDL_ALPHA_OPAQUE)) {
     LOG_ERROR("While setting the renderer color: %s\n", SDL_GetError());
     return 1;
@@ -81,50 +188,66 @@ graphics_draw5(double **surface, uint32_t n)
     LOG_ERROR("While clearing the renderer: %s\n", SDL_GetError());
     return 1;
   }
-  double mval = max(surface, n);
-  mval = mval <= 0 ? 1 : mval;
-  // Cooler
-  struct RGB blue = { 0, 0, 255, 0.0};
-  struct RGB cyan = { 0, 255, 255, 0.25};
-  struct RGB green = { 0, 255, 0, 0.5};
-  struct RGB yellow = { 255, 255, 0, 0.75};
-  struct RGB red = { 255, 0, 0, 1.0};
-  // Hotter
-  struct RGB heatmap[5] = { blue, cyan, green, yellow, red };
-  for (uint32_t i = 0; i < n; i++) {
-    for (uint32_t j = 0; j < n; j++) {
-      // Scale the point to a position in the gradiend
-      double p = surface[i][j] / mval;
-      uint8_t r = red.r, g = red.g, b = red.b;
-      for (uint8_t k = 0; k < 5; k++)
-        if (p < heatmap[k].val) {
-          struct RGB *prev = heatmap + (k - 1 < 0 ? 0 : k - 1);
-          double vdiff = prev->val - heatmap[k].val;
-          double diff = vdiff ? (p - heatmap[k].val) / vdiff : 0.0;
-          r = (uint8_t)((prev->r - heatmap[k].r) * diff + heatmap[k].r);
-          g = (uint8_t)((prev->g - heatmap[k].g) * diff + heatmap[k].g);
-          b = (uint8_t)((prev->b - heatmap[k].b) * diff + heatmap[k].b);
-          break;
-        }
-      if (SDL_SetRenderDrawColor(RENDERER, r, g, b, SDL_ALPHA_OPAQUE)) {
-        //if (SDL_SetRenderDrawColor(RENDERER, p, p, p, SDL_ALPHA_OPAQUE)) {
-        LOG_ERROR("While drawing color with: %s\n", SDL_GetError());
-        return 1;
-      }
-      if (SDL_RenderDrawPoint(RENDERER, j, i) < 0) {
-        LOG_ERROR("While drawing point %"PRIu32" %"PRIu32": %s\n", i, j,
-            SDL_GetError());
-        return 1;
-      }
-    }
+  /* Fit the largest square in the window, in real pixels for HiDPI */
+  int w, h;
+  if (SDL_GetRendererOutputSize(RENDERER, &w, &h)) {
+    LOG_ERROR("While getting the output size: %s\n", SDL_GetError());
+    return 1;
+  }
+  int size = w < h ? w : h;
+  SDL_Rect dst = { (w - size) / 2, (h - size) / 2, size, size };
+  if (SDL_RenderCopy(RENDERER, TEXTURE, NULL, &dst)) {
+    LOG_ERROR("While drawing the frame: %s\n", SDL_GetError());
+    return 1;
   }
   SDL_RenderPresent(RENDERER);
   return 0;
 }
 
+enum graphics_event
+graphics_poll(uint32_t timeout)
+{
+  SDL_Event event;
+  int rc = timeout ? SDL_WaitEventTimeout(&event, (int)timeout) :
+    SDL_PollEvent(&event);
+  if (!rc)
+    return GRAPHICS_NONE;
+  if (event.type == SDL_QUIT)
+    return GRAPHICS_QUIT;
+  if (event.type == SDL_WINDOWEVENT)
+    return GRAPHICS_REDRAW;
+  if (event.type != SDL_KEYDOWN)
+    return GRAPHICS_NONE;
+  switch (event.key.keysym.sym) {
+    case SDLK_q:
+    case SDLK_ESCAPE:
+      return GRAPHICS_QUIT;
+    case SDLK_SPACE:
+      return GRAPHICS_TOGGLE;
+    case SDLK_RIGHT:
+      return GRAPHICS_NEXT;
+    case SDLK_LEFT:
+      return GRAPHICS_PREV;
+    case SDLK_UP:
+    case SDLK_PAGEUP:
+      return GRAPHICS_FORWARD;
+    case SDLK_DOWN:
+    case SDLK_PAGEDOWN:
+      return GRAPHICS_BACKWARD;
+    case SDLK_HOME:
+      return GRAPHICS_FIRST;
+    case SDLK_END:
+      return GRAPHICS_LAST;
+    default:
+      return GRAPHICS_NONE;
+  }
+}
+
 void
 graphics_end()
 {
+  if (TEXTURE)
+    SDL_DestroyTexture(TEXTURE);
   if (RENDERER)
     SDL_DestroyRenderer(RENDERER);
   if (WINDOW)
@@ -2,57 +2,32 @@
 #include <mpi.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "arena.h"
+#include "libheat.h"
+#include "parareal.h"
+#include "ring.h"
+#include "stats.h"
+#include "stencil.h"
 #include "shared.c"
 
 #define BOUNDARY 10.0
 #define INITIAL 0.0
 
-// ad-hoc copy for the rank surface which does not copy ghost rows
-static inline void
-copy(double *a, double *b, size_t w, size_t h)
-{
-  memcpy(a + w, b + w, w * (h - 2) * sizeof(*a));
-}
-
-// ad-hoc initializer for rank surface (w, h include ghost rows)
-static void
-init(double *surface, size_t w, size_t h)
-{
-  // skip ghost rows
-  for (size_t i = 1; i < h - 1; i++) {
-    surface[i * w] = surface[(i + 1) * w - 1] = BOUNDARY;
-    for (size_t j = 1; j < w - 1; j++)
-      surface[i * w + j] = INITIAL;
-  }
-}
-
+/* Writes the n x n surface without the padding at the end of each row */
 static void
-write(FILE *f, double *surface, size_t n)
+write(FILE *f, double const *surface, size_t n, size_t pitch)
 {
-  size_t total = n * n;
-  if (fwrite(surface, sizeof(*surface), total, f) != total)
-    MPI_Abort(MPI_COMM_WORLD, errno);;
+  for (size_t i = 0; i < n; i++)
+    if (fwrite(surface + i * pitch, sizeof(*surface), n, f) != n)
+      MPI_Abort(MPI_COMM_WORLD, errno);;
 }
 
 #define WORLD MPI_COMM_WORLD
 #define TAG 0
 
-#define RECUR(w_)\
-  do{\
-    for (int j = 1; j < (w_) - 1; j++) {\
-      int center = i * args.n + j;\
-      int W = center - 1,\
-          E = center + 1,\
-          N = center - args.n,\
-          S = center + args.n;\
-      surface[center] = old_surface[center] + alpha * (old_surface[E] +\
-          old_surface[W] - 4 * old_surface[center] + old_surface[S] +\
-          old_surface[N]);\
-    }\
-  }while(0)
-
 /* Northen send index */
 #define NS 3
 /* Northen recv index */
@@ -66,6 +41,45 @@ write(FILE *f, double *surface, size_t n)
 /* Sourther recv index */
 #define SR 0
 
+/*
+ * Runs the iterations with Parareal (see parareal.h), outputting the plate at
+ * the end of each slice as a frame, and adds the seconds of each phase to
+ * times
+ */
+static void
+run_parareal(struct argp_arguments const *args, enum stencil stencil, double
+    alpha, FILE *f, struct ring *ring, FILE **levels, struct pyramid *pyramid,
+    double *times)
+{
+  int rank;
+  MPI_Comm_rank(WORLD, &rank);
+  struct parareal parareal;
+  if (parareal_init(&parareal, WORLD, args->slices, stencil, alpha,
+        (size_t)args->n, args->iters, (size_t)args->coarsen, BOUNDARY,
+        INITIAL))
+    MPI_Abort(WORLD, EXIT_FAILURE);
+  int iterations = parareal_run(&parareal, args->tolerance);
+  if (!rank)
+    fprintf(stderr, "Parareal: %d iterations of %d slices\n", iterations,
+        args->slices);
+  times[PHASE_COMPUTE] += parareal.compute;
+  times[PHASE_HALO] += parareal.exchange;
+  double mark = MPI_Wtime();
+  for (int s = 0; s < args->slices; s++) {
+    double const *plate = parareal_end(&parareal, s);
+    if (!plate)
+      continue;
+    if (args->live)
+      ring_publish(ring, plate, parareal.pitch);
+    else
+      write(f, plate, (size_t)args->n, parareal.pitch);
+    if (levels && levels_write(levels, pyramid, plate, parareal.pitch))
+      MPI_Abort(WORLD, errno);
+  }
+  lap(times + PHASE_OUTPUT, &mark, MPI_Wtime());
+  parareal_free(&parareal);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -77,8 +91,11 @@ main(int argc, char **argv)
   args.diffusivity = 0.1;
   args.n = 100;
   args.iters = 3000;
+  args.frame_stride = 1;
   args.spacestep = -1.0;
   args.timestep = -1.0;
+  args.safety = 0.9;
+  args.coarsen = PARAREAL_COARSEN;
   struct argp argp = {
     ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
   };
@@ -87,96 +104,166 @@ main(int argc, char **argv)
     fprintf(stderr, "%s, error while parsing parameters\n", argv[0]);
     return EXIT_FAILURE;
   }
-  if (args.spacestep < 0)
-    args.spacestep = 1 / (double)args.n;
-  if (args.timestep < 0)
-    args.timestep = (args.spacestep * args.spacestep) / (4 * args.diffusivity);
-  double alpha = args.diffusivity * (args.timestep / (args.spacestep * args.spacestep));
-  FILE *f = fopen("heat.bin", "w");
-  if (!f)
-    MPI_Abort(WORLD, errno);;
+  enum stencil stencil = args.stencil ? stencil_parse(args.stencil) :
+    STENCIL_5;
+  if (stencil == STENCILS || STENCIL_HALO[stencil] > 1) {
+    fprintf(stderr, "%s, unsupported stencil %s\n", argv[0], args.stencil);
+    return EXIT_FAILURE;
+  }
+  if (args.stats && args.slices) {
+    fprintf(stderr, "%s, -M does not support -P\n", argv[0]);
+    return EXIT_FAILURE;
+  }
   int rank, world_size;
   MPI_Comm_rank(WORLD, &rank);
   MPI_Comm_size(WORLD, &world_size);
+  /* Every rank gets the same timing, master reports it */
+  int stride = timing(&args, stencil, !rank);
+  if (!stride)
+    return EXIT_FAILURE;
+  double alpha = args.diffusivity * (args.timestep / (args.spacestep * args.spacestep));
+  FILE *f = NULL;
+  struct ring ring;
+  if (args.live) {
+    /* Only master publishes */
+    if (!rank && ring_create(&ring, args.live, (uint32_t)args.n))
+      MPI_Abort(WORLD, EXIT_FAILURE);
+  } else {
+    f = fopen("heat.bin", "w");
+    if (!f)
+      MPI_Abort(WORLD, errno);;
+  }
+  /* Master writes the downsampled levels along with heat.bin */
+  struct pyramid pyramid;
+  FILE **levels = NULL;
+  if (args.levels && !args.live && !rank) {
+    if (pyramid_init(&pyramid, (size_t)args.n, (size_t)args.n, args.levels))
+      MPI_Abort(WORLD, errno);
+    levels = malloc(args.levels * PYRAMID_PLANES * sizeof(*levels));
+    if (!levels || levels_open(levels, args.levels))
+      MPI_Abort(WORLD, errno);
+  }
+  /* Seconds of each phase and in total, see --time */
+  double times[PHASES + 1] = {0.0}, start = MPI_Wtime(), mark = start;
+  if (args.slices) {
+    run_parareal(&args, stencil, alpha, f, &ring, levels, &pyramid, times);
+    mark = MPI_Wtime();
+    goto report;
+  }
   int rpr = (args.n - 2) / world_size;
   int remaining = (args.n - 2) - (rpr * world_size);
-  double *esurface = NULL, *eold_surface = NULL;
+  /* All the grids of the rank come from one (huge page) mapping */
+  size_t pitch = arena_pitch((size_t)args.n);
+  size_t row_size = pitch * sizeof(double);
+  size_t arena_size = 2 * arena_reserve((size_t)(rpr + 2) * row_size);
+  if (!rank)
+    arena_size += 2 * arena_reserve((size_t)(remaining + 2) * row_size) +
+      arena_reserve((size_t)args.n * row_size);
+  struct arena arena;
+  if (arena_init(&arena, arena_size))
+    MPI_Abort(WORLD, EXIT_FAILURE);
+  /*
+   * The rank's rows, with a ghost row each side, as strips of the plate (see
+   * libheat.h). The ghost rows of the plate's own edges are its edges, the
+   * others are received from the neighbouring ranks every timestep. Only
+   * stencils with a single ghost row each side work on strips
+   */
+  struct heat heat, extra;
   if (remaining && !rank) {
-    esurface = malloc((size_t)((remaining + 2) * args.n) * sizeof(*esurface));
-    if (!esurface)
+    double *esurface = arena_alloc(&arena, (size_t)(remaining + 2) *
+        row_size);
+    double *eold_surface = arena_alloc(&arena, (size_t)(remaining + 2) *
+        row_size);
+    if (!esurface || !eold_surface)
       MPI_Abort(WORLD, errno);;
-    eold_surface = malloc((size_t)((remaining + 2) * args.n) * sizeof(*eold_surface));
-    if (!eold_surface)
-      MPI_Abort(WORLD, errno);;
-    init(esurface, (size_t)args.n, (size_t)(remaining + 2));
-    copy(eold_surface, esurface, (size_t)args.n, (size_t)(remaining + 2));
+    heat_init(&extra, stencil, esurface, eold_surface, (size_t)args.n,
+        (size_t)(remaining + 2), pitch, alpha);
+    heat_fill(&extra, BOUNDARY, INITIAL);
   }
-  double *surface = malloc((size_t)((rpr + 2) * args.n) * sizeof(*surface));
-  if (!surface)
-    MPI_Abort(WORLD, errno);;
-  double *old_surface = malloc((size_t)((rpr + 2) * args.n) * sizeof(*old_surface));
-  if (!old_surface)
+  double *surface = arena_alloc(&arena, (size_t)(rpr + 2) * row_size);
+  double *old_surface = arena_alloc(&arena, (size_t)(rpr + 2) * row_size);
+  if (!surface || !old_surface)
     MPI_Abort(WORLD, errno);;
+  heat_init(&heat, stencil, surface, old_surface, (size_t)args.n,
+      (size_t)(rpr + 2), pitch, alpha);
+  heat_fill(&heat, BOUNDARY, INITIAL);
   double *wsurface = NULL;
   if (rank == 0) {
-    wsurface = malloc((size_t)(args.n * args.n) * sizeof(*wsurface));
-    for (int j = 0; j < args.n; j++)
-      wsurface[j] = wsurface[(args.n - 1) * args.n + j] = BOUNDARY;
+    wsurface = arena_alloc(&arena, (size_t)args.n * row_size);
     if (!wsurface)
       MPI_Abort(WORLD, errno);;
-  }
-  init(surface, (size_t)args.n, (size_t)(rpr + 2));
-  copy(old_surface, surface, (size_t)args.n, (size_t)(rpr + 2));
-  /* Ghost boundaries */
-  if (!rank) {
-    for (int j = 0; j < args.n; j++)
-      surface[j] = old_surface[j] = BOUNDARY;
-    if (remaining)
-      for (int j = 0; j < args.n; j++)
-        esurface[(remaining + 1) * args.n + j] = eold_surface[(remaining + 1) * args.n + j] = BOUNDARY;
-  } else if (rank == world_size - 1 && !remaining) {
     for (int j = 0; j < args.n; j++)
-      surface[(rpr + 1) * args.n + j] = old_surface[(rpr + 1) * args.n + j] = BOUNDARY;
+      wsurface[j] = wsurface[(size_t)(args.n - 1) * pitch + (size_t)j] =
+        BOUNDARY;
   }
+  /*
+   * Master creates the segment, with a slot per rank. Ranks on other nodes
+   * cannot attach to it, they go on without publishing
+   */
+  struct stats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (args.stats) {
+    if (!rank && stats_create(&stats, args.stats, (uint32_t)world_size,
+          (uint64_t)args.iters, args.timestep))
+      MPI_Abort(WORLD, EXIT_FAILURE);
+    MPI_Barrier(WORLD);
+    if (rank)
+      stats_attach(&stats, args.stats, (uint32_t)rank);
+  }
+  struct stats_record record = {
+    0, (uint64_t)(rank ? rpr : rpr + remaining) * (uint64_t)(args.n - 2), 0, 0,
+    0.0, 0.0, 0.0, -1.0
+  };
+  /* The rows sent to master last iteration, their grid must not change until sent */
+  MPI_Request sss = MPI_REQUEST_NULL;
+  start = mark = MPI_Wtime();
   for (int iters = 0; iters < args.iters; iters++) {
     // TODO improve this array thing
-    MPI_Request requests[6];
+    MPI_Request requests[6] = {
+      MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL,
+      MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL
+    };
+    double *plate = heat.plate;
     if (rank) {
       /* Get our upper ghost row from the northen rank */
-      MPI_Irecv(old_surface + 1, args.n - 2, MPI_DOUBLE, rank - 1, TAG, WORLD, requests + NR);
+      MPI_Irecv(plate + 1, args.n - 2, MPI_DOUBLE, rank - 1, TAG, WORLD, requests + NR);
       /* Send our upper dep row to the northen rank */
-      MPI_Isend(old_surface + args.n + 1, args.n - 2, MPI_DOUBLE, rank - 1, TAG, WORLD, requests + NS);
+      MPI_Isend(plate + pitch + 1, args.n - 2, MPI_DOUBLE, rank - 1, TAG, WORLD, requests + NS);
     }
     if (rank != world_size - 1 || remaining) {
       int south = rank + 1 == world_size ? 0 : rank + 1;
       /* Get our bottom ghost row from the southern rank */
-      MPI_Irecv(old_surface + (rpr + 1) * args.n + 1, args.n - 2, MPI_DOUBLE, south, TAG, WORLD, requests + SR);
+      MPI_Irecv(plate + (size_t)(rpr + 1) * pitch + 1, args.n - 2, MPI_DOUBLE, south, TAG, WORLD, requests + SR);
       /* Send our bottom dep row to the southern rank */
-      MPI_Isend(old_surface + rpr * args.n + 1, args.n - 2, MPI_DOUBLE, south, TAG, WORLD, requests + SS);
+      MPI_Isend(plate + (size_t)rpr * pitch + 1, args.n - 2, MPI_DOUBLE, south, TAG, WORLD, requests + SS);
     }
+    lap(times + PHASE_HALO, &mark, MPI_Wtime());
+    MPI_Wait(&sss, MPI_STATUS_IGNORE);
+    lap(times + PHASE_OUTPUT, &mark, MPI_Wtime());
     /* Calculate heat within rank submatrix except on dep rows */
     /* Skip ghost rows */
-    for (int i = 2; i < rpr; i++)
-      RECUR(args.n);
+    heat_strip(&heat, 2, (size_t)rpr, 0.0);
+    lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
     /* Master has to work extra if there are remaining rows */
     if (!rank && remaining) {
-      double *kludge = surface, *okludge = old_surface;
-      surface = esurface; old_surface = eold_surface;
       /* Skip ghost and dep rows */
-      for (int i = 2; i < remaining; i++)
-        RECUR(args.n);
+      heat_strip(&extra, 2, (size_t)remaining, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
       /* Get our upper ghost row from the northen rank */
-      MPI_Irecv(old_surface + 1, args.n - 2, MPI_DOUBLE, world_size - 1, TAG, WORLD, requests + NR2);
+      MPI_Irecv(extra.plate + 1, args.n - 2, MPI_DOUBLE, world_size - 1, TAG, WORLD, requests + NR2);
       /* Send our upper dep row to the northen rank */
-      MPI_Isend(old_surface + args.n + 1, args.n - 2, MPI_DOUBLE, world_size - 1, TAG, WORLD, requests + NS2);
+      MPI_Isend(extra.plate + pitch + 1, args.n - 2, MPI_DOUBLE, world_size - 1, TAG, WORLD, requests + NS2);
+      lap(times + PHASE_HALO, &mark, MPI_Wtime());
       /* Calculate heat on dep rows once we recv them */
-      int i = remaining;
-      RECUR(args.n);
+      heat_strip(&extra, (size_t)remaining, (size_t)remaining + 1, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
       MPI_Wait(requests + NR2, MPI_STATUS_IGNORE);
-      i = 1;
-      RECUR(args.n);
-      copy(eold_surface, esurface, (size_t)args.n, (size_t)(remaining + 2));
-      surface = kludge; old_surface = okludge;
+      lap(times + PHASE_HALO, &mark, MPI_Wtime());
+      heat_strip(&extra, 1, 2, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
+      MPI_Wait(requests + NS2, MPI_STATUS_IGNORE);
+      lap(times + PHASE_HALO, &mark, MPI_Wtime());
+      heat_swap(&extra);
     }
     /* Calculate heat on dep rows once we recv them */
     if (rank && (rank != world_size - 1 || remaining)) {
@@ -184,47 +271,100 @@ main(int argc, char **argv)
       int done = 0;
       while (done < 2) {
         MPI_Waitany(2, requests, &ready, MPI_STATUS_IGNORE);
-        int i = ready == NR ? 1 : rpr;
-        RECUR(args.n);
+        lap(times + PHASE_HALO, &mark, MPI_Wtime());
+        size_t i = ready == NR ? 1 : (size_t)rpr;
+        heat_strip(&heat, i, i + 1, 0.0);
+        lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
         done++;
       }
       /* Notice the first and last rank do not have to wait for N/S row */
     } else if (!rank) {
-      int i = 1;
-      RECUR(args.n);
+      heat_strip(&heat, 1, 2, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
       MPI_Wait(requests + SR, MPI_STATUS_IGNORE);
-      i = rpr;
-      RECUR(args.n);
+      lap(times + PHASE_HALO, &mark, MPI_Wtime());
+      heat_strip(&heat, (size_t)rpr, (size_t)rpr + 1, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
     } else {
-      int i = rpr;
-      RECUR(args.n);
+      heat_strip(&heat, (size_t)rpr, (size_t)rpr + 1, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
       MPI_Wait(requests + NR, MPI_STATUS_IGNORE);
-      i = 1;
-      RECUR(args.n);
+      lap(times + PHASE_HALO, &mark, MPI_Wtime());
+      heat_strip(&heat, 1, 2, 0.0);
+      lap(times + PHASE_COMPUTE, &mark, MPI_Wtime());
     }
-    copy(old_surface, surface, (size_t)args.n, (size_t)(rpr + 2));
+    /* The dep rows must be sent before their grid is the next to write */
+    MPI_Waitall(6, requests, MPI_STATUSES_IGNORE);
+    lap(times + PHASE_HALO, &mark, MPI_Wtime());
+    heat_swap(&heat);
+    record.iters = (uint64_t)iters + 1;
+    record.time = (double)(iters + 1) * args.timestep;
+    record.io = times[PHASE_OUTPUT];
+    record.halo = times[PHASE_HALO];
+    if (stats_asked(&stats)) {
+      record.residual = heat_residual(&heat, 1, (size_t)rpr + 1);
+      if (!rank && remaining)
+        record.residual = fmax(record.residual, heat_residual(&extra, 1,
+              (size_t)remaining + 1));
+    }
+    stats_update(&stats, &record);
+    /* Only every stride iterations make a frame */
+    if ((iters + 1) % stride)
+      continue;
     // TODO put all this in a buffer and send to master at the end
     /* Send info to master */
     if (rank) {
-      MPI_Request sss;
       /* Don't send ghost rows */
-      MPI_Isend(surface + args.n, rpr * args.n, MPI_DOUBLE, 0, TAG, WORLD, &sss);
+      MPI_Isend(heat.plate + pitch, rpr * (int)pitch, MPI_DOUBLE, 0, TAG, WORLD, &sss);
     } else {
-      MPI_Request sss[world_size - 1];
-      memcpy(wsurface + args.n, surface + args.n, (size_t)(rpr * args.n) * sizeof(*wsurface));
+      MPI_Request gather[world_size - 1];
+      memcpy(wsurface + pitch, heat.plate + pitch, (size_t)rpr * row_size);
       if (remaining)
-        memcpy(wsurface + (world_size * rpr + 1) * args.n, esurface + args.n, (size_t)(remaining * args.n) * sizeof(*wsurface));
+        memcpy(wsurface + (size_t)(world_size * rpr + 1) * pitch, extra.plate + pitch, (size_t)remaining * row_size);
       for (int r = 1; r < world_size; r++)
-        MPI_Irecv(wsurface + (r * rpr + 1) * args.n, rpr * args.n, MPI_DOUBLE, r, TAG, WORLD, sss + r - 1);
-      MPI_Waitall(world_size - 1, sss, MPI_STATUS_IGNORE);
-      write(f, wsurface, (size_t)args.n);
+        MPI_Irecv(wsurface + (size_t)(r * rpr + 1) * pitch, rpr * (int)pitch, MPI_DOUBLE, r, TAG, WORLD, gather + r - 1);
+      MPI_Waitall(world_size - 1, gather, MPI_STATUSES_IGNORE);
+      if (args.live)
+        ring_publish(&ring, wsurface, pitch);
+      else
+        write(f, wsurface, (size_t)args.n, pitch);
+      if (levels && levels_write(levels, &pyramid, wsurface, pitch))
+        MPI_Abort(WORLD, errno);
     }
+    lap(times + PHASE_OUTPUT, &mark, MPI_Wtime());
   }
   // todo remaining rows
-  free(surface);
-  free(old_surface);
-  if (fclose(f))
+  /* The arena is unmapped, unlike freed memory, so the send must be done */
+  MPI_Wait(&sss, MPI_STATUS_IGNORE);
+  lap(times + PHASE_OUTPUT, &mark, MPI_Wtime());
+  arena_free(&arena);
+  record.io = times[PHASE_OUTPUT];
+  stats_update(&stats, &record);
+  /* Master only removes the segment once nobody publishes to it */
+  MPI_Barrier(WORLD);
+  stats_close(&stats);
+report:
+  times[PHASES] = mark - start;
+  if (args.time) {
+    /* Master prints everyone's */
+    double all[rank ? 1 : (PHASES + 1) * world_size];
+    MPI_Gather(times, PHASES + 1, MPI_DOUBLE, all, PHASES + 1, MPI_DOUBLE, 0,
+        WORLD);
+    if (!rank)
+      phases_print(all, world_size);
+  }
+  if (levels) {
+    if (levels_close(levels, args.levels))
+      MPI_Abort(WORLD, errno);
+    free(levels);
+    pyramid_free(&pyramid);
+  }
+  if (args.live) {
+    if (!rank)
+      ring_close(&ring);
+  } else if (fclose(f)) {
     MPI_Abort(WORLD, errno);;
+  }
   MPI_Finalize();
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,300 @@
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "parareal.h"
+#include "logging.h"
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARAREAL_TAG 0
+
+/*
+ * Fraction of the largest stable timestep the coarse engine takes. At half of
+ * it the highest frequencies die out in a single timestep, as they would with
+ * an implicit engine, instead of oscillating for the rest of the slice.
+ */
+#define PARAREAL_DAMPING 0.5
+
+/* Adds the time from *mark to now to *seconds, moving the mark to now */
+static inline void
+parareal_lap(double *seconds, double *mark)
+{
+  double now = MPI_Wtime();
+  *seconds += now - *mark;
+  *mark = now;
+}
+
+/* The m x m grid, with rows pitch doubles apart, interpolated at (y, x) */
+static inline double
+parareal_sample(double const *grid, size_t m, size_t pitch, double y, double
+    x)
+{
+  size_t i = (size_t)y, j = (size_t)x;
+  if (i > m - 2)
+    i = m - 2;
+  if (j > m - 2)
+    j = m - 2;
+  double fy = y - (double)i, fx = x - (double)j;
+  double const *c = grid + i * pitch + j;
+  return (1 - fy) * ((1 - fx) * c[0] + fx * c[1]) + fy * ((1 - fx) *
+      c[pitch] + fx * c[pitch + 1]);
+}
+
+/* G: the interior of end from start, through the coarse grid */
+static void
+parareal_coarse(struct parareal *parareal, double const *start, double *end)
+{
+  struct heat *coarse = &parareal->coarse;
+  size_t n = parareal->n, pitch = parareal->pitch, m = coarse->w;
+  double scale = (double)(n - 1) / (double)(m - 1);
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < m; j++)
+      coarse->plate[i * coarse->pitch + j] = parareal_sample(start, n, pitch,
+          (double)i * scale, (double)j * scale);
+  heat_mirror(coarse);
+  for (int k = 0; k < parareal->coarse_steps; k++) {
+    heat_strip(coarse, 1, m - 1, 0.0);
+    heat_swap(coarse);
+  }
+  for (size_t i = 1; i < n - 1; i++)
+    for (size_t j = 1; j < n - 1; j++)
+      end[i * pitch + j] = parareal_sample(coarse->plate, m, coarse->pitch,
+          (double)i / scale, (double)j / scale);
+}
+
+/*
+ * F: end from start, each rank of the slice calculating its strip like par,
+ * and then gathering everyone's
+ */
+static void
+parareal_fine(struct parareal *parareal, double const *start, double *end)
+{
+  struct heat *fine = &parareal->fine;
+  size_t pitch = parareal->pitch, rows = parareal->last - parareal->first;
+  int count = (int)parareal->n - 2;
+  /* The edges of the plate are the ghost rows of the first and last strips */
+  int north = parareal->rank ? parareal->rank - 1 : MPI_PROC_NULL;
+  int south = parareal->rank + 1 < parareal->ranks ? parareal->rank + 1 :
+    MPI_PROC_NULL;
+  double mark = MPI_Wtime();
+  memcpy(fine->plate, start + (parareal->first - 1) * pitch, (rows + 2) *
+      pitch * sizeof(*start));
+  heat_mirror(fine);
+  for (int k = 0; k < parareal->steps; k++) {
+    double *plate = fine->plate;
+    MPI_Request requests[4];
+    MPI_Irecv(plate + 1, count, MPI_DOUBLE, north, PARAREAL_TAG,
+        parareal->space, requests);
+    MPI_Irecv(plate + (rows + 1) * pitch + 1, count, MPI_DOUBLE, south,
+        PARAREAL_TAG, parareal->space, requests + 1);
+    MPI_Isend(plate + pitch + 1, count, MPI_DOUBLE, north, PARAREAL_TAG,
+        parareal->space, requests + 2);
+    MPI_Isend(plate + rows * pitch + 1, count, MPI_DOUBLE, south,
+        PARAREAL_TAG, parareal->space, requests + 3);
+    parareal_lap(&parareal->exchange, &mark);
+    /* The rows not next to the ghost rows while they arrive */
+    heat_strip(fine, 2, rows, 0.0);
+    parareal_lap(&parareal->compute, &mark);
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+    parareal_lap(&parareal->exchange, &mark);
+    heat_strip(fine, 1, 2, 0.0);
+    if (rows > 1)
+      heat_strip(fine, rows, rows + 1, 0.0);
+    heat_swap(fine);
+    parareal_lap(&parareal->compute, &mark);
+  }
+  memcpy(end + parareal->first * pitch, fine->plate + pitch, rows * pitch *
+      sizeof(*end));
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DOUBLE, end, parareal->counts,
+      parareal->displs, MPI_DOUBLE, parareal->space);
+  parareal_lap(&parareal->exchange, &mark);
+}
+
+int
+parareal_init(struct parareal *parareal, MPI_Comm world, int slices, enum
+    stencil stencil, double alpha, size_t n, int iters, size_t coarsen, double
+    edge, double inside)
+{
+  memset(parareal, 0, sizeof(*parareal));
+  parareal->space = parareal->time = MPI_COMM_NULL;
+  int rank, size;
+  MPI_Comm_rank(world, &rank);
+  MPI_Comm_size(world, &size);
+  if (slices < 1 || size % slices || iters < slices || n < 3 || (size_t)(size
+        / slices) > n - 2 || !coarsen || STENCIL_HALO[stencil] > 1) {
+    if (!rank)
+      LOG_ERROR("Parareal: The %d ranks should split evenly in %d slices of "
+          "at least a timestep, with at most a rank per row, and the stencil "
+          "be 5 or 9 points\n", size, slices);
+    return 1;
+  }
+  int ranks = parareal->ranks = size / slices;
+  int slice = parareal->slice = rank / ranks;
+  parareal->slices = slices;
+  parareal->rank = rank % ranks;
+  MPI_Comm_split(world, slice, rank, &parareal->space);
+  MPI_Comm_split(world, parareal->rank, rank, &parareal->time);
+  size_t pitch = parareal->pitch = arena_pitch(n);
+  parareal->n = n;
+  parareal->steps = (int)((long long)iters * (slice + 1) / slices - (long
+        long)iters * slice / slices);
+  parareal->counts = malloc(2 * (size_t)ranks * sizeof(*parareal->counts));
+  if (!parareal->counts) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  parareal->displs = parareal->counts + ranks;
+  for (int r = 0; r < ranks; r++) {
+    size_t first = 1 + (n - 2) * (size_t)r / (size_t)ranks;
+    size_t last = 1 + (n - 2) * (size_t)(r + 1) / (size_t)ranks;
+    parareal->counts[r] = (int)((last - first) * pitch);
+    parareal->displs[r] = (int)(first * pitch);
+    if (r == parareal->rank) {
+      parareal->first = first;
+      parareal->last = last;
+    }
+  }
+  /* Coarsening past 3 x 3 would leave no interior */
+  size_t m = (n - 1 + coarsen - 1) / coarsen + 1;
+  if (m < 3)
+    m = 3;
+  size_t cpitch = arena_pitch(m);
+  size_t plate = n * pitch * sizeof(double);
+  size_t strip = (parareal->last - parareal->first + 2) * pitch *
+    sizeof(double);
+  size_t grid = m * cpitch * sizeof(double);
+  if (arena_init(&parareal->arena, 5 * arena_reserve(plate) + 2 *
+        arena_reserve(strip) + 2 * arena_reserve(grid)))
+    return 1;
+  double **plates[] = {
+    &parareal->start, &parareal->end, &parareal->fine_end,
+    &parareal->coarse_end, &parareal->coarse_next
+  };
+  for (size_t k = 0; k < sizeof(plates) / sizeof(*plates); k++) {
+    double *p = *plates[k] = arena_alloc(&parareal->arena, plate);
+    if (!p) {
+      LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+      return 1;
+    }
+    /* Only the interiors are written from here on */
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        p[i * pitch + j] = i == 0 || i == n - 1 || j == 0 || j == n - 1 ?
+          edge : inside;
+  }
+  double *fine = arena_alloc(&parareal->arena, strip);
+  double *fine_next = arena_alloc(&parareal->arena, strip);
+  double *coarse = arena_alloc(&parareal->arena, grid);
+  double *coarse_next = arena_alloc(&parareal->arena, grid);
+  if (!fine || !fine_next || !coarse || !coarse_next) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  heat_init(&parareal->fine, stencil, fine, fine_next, n, parareal->last -
+      parareal->first + 2, pitch, alpha);
+  /* The whole slice in as few coarse timesteps as damp enough */
+  double scale = (double)(n - 1) / (double)(m - 1);
+  double total = parareal->steps * alpha / (scale * scale);
+  parareal->coarse_steps = (int)ceil(total / (PARAREAL_DAMPING *
+        STENCIL_LIMIT[stencil]));
+  heat_init(&parareal->coarse, stencil, coarse, coarse_next, m, m, cpitch,
+      parareal->coarse_steps ? total / parareal->coarse_steps : 0.0);
+  return 0;
+}
+
+int
+parareal_run(struct parareal *parareal, double tolerance)
+{
+  size_t n = parareal->n, pitch = parareal->pitch;
+  int count = (int)(n * pitch), slice = parareal->slice;
+  bool last = slice + 1 == parareal->slices;
+  double mark = MPI_Wtime();
+  /* The first guess, the coarse engine alone */
+  if (slice)
+    MPI_Recv(parareal->start, count, MPI_DOUBLE, slice - 1, PARAREAL_TAG,
+        parareal->time, MPI_STATUS_IGNORE);
+  parareal_lap(&parareal->exchange, &mark);
+  parareal_coarse(parareal, parareal->start, parareal->coarse_end);
+  memcpy(parareal->end, parareal->coarse_end, n * pitch * sizeof(double));
+  parareal_lap(&parareal->compute, &mark);
+  if (!last)
+    MPI_Send(parareal->end, count, MPI_DOUBLE, slice + 1, PARAREAL_TAG,
+        parareal->time);
+  parareal_lap(&parareal->exchange, &mark);
+  int k = 0;
+  while (k < parareal->slices) {
+    k++;
+    double change = 0.0;
+    /* The slices before k - 1 are exact since the last iteration */
+    if (slice >= k - 1) {
+      parareal_fine(parareal, parareal->start, parareal->fine_end);
+      mark = MPI_Wtime();
+      /* That of slice k - 1 is too, and it did not change */
+      double *coarse = parareal->coarse_end;
+      if (slice >= k) {
+        MPI_Recv(parareal->start, count, MPI_DOUBLE, slice - 1, PARAREAL_TAG,
+            parareal->time, MPI_STATUS_IGNORE);
+        parareal_lap(&parareal->exchange, &mark);
+        coarse = parareal->coarse_next;
+        parareal_coarse(parareal, parareal->start, coarse);
+      }
+      double *end = parareal->fine_end;
+      for (size_t i = 1; i < n - 1; i++)
+        for (size_t j = 1; j < n - 1; j++) {
+          size_t x = i * pitch + j;
+          end[x] += coarse[x] - parareal->coarse_end[x];
+          change = fmax(change, fabs(end[x] - parareal->end[x]));
+        }
+      parareal->fine_end = parareal->end;
+      parareal->end = end;
+      if (coarse != parareal->coarse_end) {
+        parareal->coarse_next = parareal->coarse_end;
+        parareal->coarse_end = coarse;
+      }
+      parareal_lap(&parareal->compute, &mark);
+      if (!last)
+        MPI_Send(parareal->end, count, MPI_DOUBLE, slice + 1, PARAREAL_TAG,
+            parareal->time);
+    }
+    /* The same on every rank of a slice */
+    MPI_Allreduce(MPI_IN_PLACE, &change, 1, MPI_DOUBLE, MPI_MAX,
+        parareal->time);
+    parareal_lap(&parareal->exchange, &mark);
+    if (change <= tolerance)
+      break;
+  }
+  return k;
+}
+
+double const *
+parareal_end(struct parareal *parareal, int slice)
+{
+  if (parareal->rank)
+    return NULL;
+  int count = (int)(parareal->n * parareal->pitch);
+  if (parareal->slice == slice && !slice)
+    return parareal->end;
+  if (!parareal->slice) {
+    /* Done with F, so its plate is free */
+    MPI_Recv(parareal->fine_end, count, MPI_DOUBLE, slice, PARAREAL_TAG,
+        parareal->time, MPI_STATUS_IGNORE);
+    return parareal->fine_end;
+  }
+  if (parareal->slice == slice)
+    MPI_Send(parareal->end, count, MPI_DOUBLE, 0, PARAREAL_TAG,
+        parareal->time);
+  return NULL;
+}
+
+void
+parareal_free(struct parareal *parareal)
+{
+  free(parareal->counts);
+  arena_free(&parareal->arena);
+  if (parareal->space != MPI_COMM_NULL)
+    MPI_Comm_free(&parareal->space);
+  if (parareal->time != MPI_COMM_NULL)
+    MPI_Comm_free(&parareal->time);
+}
@@ -0,0 +1,95 @@
+#pragma once
+/*
+ * Parareal: parallel in time as well as in space. The iterations are split in
+ * slices, each calculated at once by its own group of ranks, which splits the
+ * plate in strips among itself like par does without it. A slice cannot start
+ * before the one before it ends, so each starts from a guess which is
+ * corrected until it stops changing.
+ *
+ * The guesses come from a coarse engine G, a cheap approximation of the fine
+ * engine F (the timesteps of par, see libheat.h): the plate sampled on a
+ * grid coarsen times as sparse, on which the stencil takes coarsen^2 times as
+ * long timesteps at the same stability, and interpolated back. With U(s) the
+ * start of slice s, a first guess of every start is the coarse engine alone,
+ * slice after slice: U(s + 1) = G(U(s)). Then every iteration calculates F of
+ * every start at once, and corrects the starts slice after slice:
+ *
+ *   U'(s + 1) = F(U(s)) + G(U'(s)) - G(U(s))
+ *
+ * The start of the first slice is exact, so after k iterations those of the
+ * first k + 1 slices are: only the slices from k on are calculated in the
+ * next, and after as many iterations as slices the result is what par gets
+ * without Parareal, bit for bit. The iterations stop before that once no
+ * start changes by more than a tolerance between two. An iteration takes as
+ * long as a slice of F plus a slice of G per slice, so k iterations take
+ * about k / slices of the time without Parareal: the speedup comes from
+ * converging in a few.
+ *
+ * Every rank has whole plates (only its strip is calculated by F), so the
+ * coarse engine and the corrections need no gathering but the plates are
+ * sent between the groups whole. That suits smaller plates and many ranks,
+ * for which par alone would spend most of its time exchanging ghost rows.
+ */
+#include "arena.h"
+#include "libheat.h"
+#include "stencil.h"
+#include <mpi.h>
+#include <stddef.h>
+
+/* Spacing of the points of the coarse grid, in those of the plate, by default */
+#define PARAREAL_COARSEN 4
+
+struct parareal {
+  /* The ranks of the slice, and those with the same strip of every slice */
+  MPI_Comm space, time;
+  int slices, slice, ranks, rank;
+  size_t n, pitch;
+  /* Timesteps of the slice */
+  int steps;
+  /* F on the rows [first, last) of the plate, with a ghost row each side */
+  struct heat fine;
+  size_t first, last;
+  /* The strip of every rank of the slice, in doubles, for MPI_Allgatherv */
+  int *counts, *displs;
+  /* G on the whole coarse grid, and its timesteps over the slice */
+  struct heat coarse;
+  int coarse_steps;
+  /* Whole plates: the start of the slice, its end, F of the start, G of the
+   * start and G of the next start */
+  double *start, *end, *fine_end, *coarse_end, *coarse_next;
+  struct arena arena;
+  /* Seconds in the engines and in exchanges with other ranks */
+  double compute, exchange;
+};
+
+/*
+ * Splits the ranks of world evenly in slices groups, each calculating
+ * iters / slices of the iters timesteps of alpha with stencil (5 or 9) of the
+ * n x n plate, whose edges are edge and the rest inside to start with. The
+ * coarse grid has a point every coarsen (> 0) points of the plate. Collective
+ * over world. Returns 0 on success, 1 on error, reporting the error to
+ * stderr. On error, call parareal_free anyway.
+ */
+int
+parareal_init(struct parareal *parareal, MPI_Comm world, int slices, enum
+    stencil stencil, double alpha, size_t n, int iters, size_t coarsen, double
+    edge, double inside);
+
+/*
+ * Iterates until no start changes by more than tolerance, or the result is
+ * exact. Collective over the world of parareal_init. Returns the iterations
+ * done, after the first guess.
+ */
+int
+parareal_run(struct parareal *parareal, double tolerance);
+
+/*
+ * Collective over the world of parareal_init: returns the plate at the end of
+ * slice, rows pitch doubles apart, on rank 0 of world (valid until the next
+ * call), NULL on the others.
+ */
+double const *
+parareal_end(struct parareal *parareal, int slice);
+
+void
+parareal_free(struct parareal *parareal);
@@ -0,0 +1,213 @@
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "ring.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RING_MAGIC 0x676e697274616568ull /* "heatring" */
+
+/*
+ * Looks at the latest frame before giving up on it. The solver never writes
+ * to the slot of the latest frame, only over it once the ring wraps around,
+ * so this only happens if it keeps wrapping around onto the frames being
+ * read faster than they can be copied, or died halfway through doing so
+ */
+#define RING_TRIES 1000000
+
+/* Frames start on their own cache line */
+#define RING_FRAMES ((sizeof(struct ring_header) + 63) & ~(size_t)63)
+
+static size_t
+ring_size(uint32_t n)
+{
+  return RING_FRAMES + (size_t)RING_SLOTS * n * n * sizeof(double);
+}
+
+/* Maps the segment behind fd and points ring at it */
+static int
+ring_map(struct ring *ring, int fd, size_t size, int prot, char const *name)
+{
+  void *map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERROR("%s: Could not mmap: %s\n", name, strerror(errno));
+    return 1;
+  }
+  ring->header = map;
+  ring->frames = (double *)((char *)map + RING_FRAMES);
+  ring->size = size;
+  return 0;
+}
+
+/*
+ * Whether the segment name belongs to a solver which is still running,
+ * reporting it to stderr if so. Anything else there (left by a run which did
+ * not exit cleanly, or not a ring at all) is stale.
+ */
+static bool
+ring_live(char const *name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  bool ans = false;
+  struct stat st;
+  if (!fstat(fd, &st) && (size_t)st.st_size >= sizeof(struct ring_header)) {
+    struct ring_header *header = mmap(NULL, sizeof(*header), PROT_READ,
+        MAP_SHARED, fd, 0);
+    if (header != MAP_FAILED) {
+      pid_t pid = (pid_t)header->pid;
+      ans = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == RING_MAGIC
+        && !__atomic_load_n(&header->done, __ATOMIC_ACQUIRE) && pid > 0 &&
+        (!kill(pid, 0) || errno == EPERM);
+      munmap(header, sizeof(*header));
+      if (ans)
+        LOG_ERROR("Could not create %s: %s, used by pid %ld\n", name,
+            strerror(EEXIST), (long)pid);
+    }
+  }
+  close(fd);
+  return ans;
+}
+
+int
+ring_create(struct ring *ring, char const *name, uint32_t n)
+{
+  int ans = 1;
+  memset(ring, 0, sizeof(*ring));
+  if (ring_live(name)) {
+    errno = EEXIST;
+    goto create_return;
+  }
+  /* Whatever else is there was left by a run which did not exit cleanly */
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Could not create %s: %s\n", name, strerror(errno));
+    goto create_return;
+  }
+  size_t size = ring_size(n);
+  if (ftruncate(fd, (off_t)size)) {
+    LOG_ERROR("%s: Could not resize: %s\n", name, strerror(errno));
+    goto create_unlink;
+  }
+  if (ring_map(ring, fd, size, PROT_READ | PROT_WRITE, name))
+    goto create_unlink;
+  ring->header->n = n;
+  ring->header->slots = RING_SLOTS;
+  ring->header->pid = (int64_t)getpid();
+  ring->name = name;
+  /* Viewers check the magic last, so everything else is in place by then */
+  __atomic_store_n(&ring->header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+  ans = 0;
+  goto create_fd;
+create_unlink:
+  shm_unlink(name);
+create_fd:
+  close(fd);
+create_return:
+  return ans;
+}
+
+int
+ring_attach(struct ring *ring, char const *name)
+{
+  int ans = 1;
+  memset(ring, 0, sizeof(*ring));
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    LOG_ERROR("Could not open %s: %s\n", name, strerror(errno));
+    goto attach_return;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    LOG_ERROR("%s: Could not stat: %s\n", name, strerror(errno));
+    goto attach_fd;
+  }
+  if ((size_t)st.st_size < sizeof(struct ring_header)) {
+    LOG_ERROR("%s: Not a heat ring buffer\n", name);
+    goto attach_fd;
+  }
+  if (ring_map(ring, fd, (size_t)st.st_size, PROT_READ, name))
+    goto attach_fd;
+  if (__atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+      ring->header->slots != RING_SLOTS ||
+      ring_size(ring->header->n) != (size_t)st.st_size) {
+    LOG_ERROR("%s: Not a heat ring buffer\n", name);
+    munmap(ring->header, ring->size);
+    memset(ring, 0, sizeof(*ring));
+    goto attach_fd;
+  }
+  ans = 0;
+attach_fd:
+  close(fd);
+attach_return:
+  return ans;
+}
+
+void
+ring_publish(struct ring *ring, double const *surface, size_t pitch)
+{
+  struct ring_header *header = ring->header;
+  size_t n = header->n, area = n * n;
+  uint64_t f = header->head;
+  uint64_t *seq = header->seq + f % RING_SLOTS;
+  __atomic_store_n(seq, 2 * f + 1, __ATOMIC_RELAXED);
+  /* The odd sequence number has to be visible before any of the frame is */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  double *frame = ring->frames + (f % RING_SLOTS) * area;
+  for (size_t i = 0; i < n; i++)
+    memcpy(frame + i * n, surface + i * pitch, n * sizeof(*surface));
+  __atomic_store_n(seq, 2 * f + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&header->head, f + 1, __ATOMIC_RELEASE);
+}
+
+int
+ring_latest(struct ring const *ring, double *surface, uint64_t *seen)
+{
+  struct ring_header *header = ring->header;
+  size_t area = (size_t)header->n * header->n;
+  for (unsigned tries = 0; tries < RING_TRIES; tries++) {
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    if (head <= *seen)
+      return 1;
+    uint64_t f = head - 1;
+    uint64_t *seq = header->seq + f % RING_SLOTS;
+    uint64_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    /* Already being overwritten by a newer frame, go get that one */
+    if (before != 2 * f + 2)
+      continue;
+    memcpy(surface, ring->frames + (f % RING_SLOTS) * area, area *
+        sizeof(*surface));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) {
+      *seen = head;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+bool
+ring_done(struct ring const *ring)
+{
+  return __atomic_load_n(&ring->header->done, __ATOMIC_ACQUIRE);
+}
+
+void
+ring_close(struct ring *ring)
+{
+  if (!ring->header)
+    return;
+  if (ring->name) {
+    __atomic_store_n(&ring->header->done, 1, __ATOMIC_RELEASE);
+    shm_unlink(ring->name);
+  }
+  munmap(ring->header, ring->size);
+  memset(ring, 0, sizeof(*ring));
+}
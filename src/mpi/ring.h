@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Live frames over a POSIX shared memory ring buffer. The solver publishes
+ * every frame into one of RING_SLOTS slots and never waits for anyone, while
+ * any number of viewers attach by name and copy out the latest frame. Each
+ * slot is guarded by a sequence number (a seqlock) which is odd while the
+ * slot is being written, so a viewer that got lapped by the solver while
+ * copying notices it and retries instead of showing a torn frame. Frames a
+ * slow viewer did not get to are simply dropped.
+ */
+
+#define RING_SLOTS 4
+
+/* Layout of the start of the shared memory segment, followed by the frames */
+struct ring_header {
+  uint64_t magic;
+  uint32_t n, slots;
+  /* Number of frames published so far */
+  uint64_t head;
+  /* Set once the solver is done publishing */
+  uint64_t done;
+  /* Of the solver, to tell a segment left by a crashed run from a live one */
+  int64_t pid;
+  /* Frame f is complete in slot f % slots iff seq[f % slots] == 2 * f + 2 */
+  uint64_t seq[RING_SLOTS];
+};
+
+struct ring {
+  struct ring_header *header;
+  double *frames;
+  size_t size;
+  /* Only set for the solver, which removes the segment on ring_close */
+  char const *name;
+};
+
+/*
+ * Creates the segment name for nxn frames, replacing a stale one left by a
+ * previous run. Returns 0 on success, 1 on error (with errno EEXIST if a
+ * solver still running has the segment), reporting the error to stderr. On
+ * error, nothing is created.
+ */
+int
+ring_create(struct ring *ring, char const *name, uint32_t n);
+
+/* Same as ring_create, but attaches to an existing segment as a viewer. */
+int
+ring_attach(struct ring *ring, char const *name);
+
+/* Publishes a nxn frame, with rows pitch doubles apart. Never blocks. */
+void
+ring_publish(struct ring *ring, double const *surface, size_t pitch);
+
+/*
+ * Copies the latest frame into surface (n * n doubles) if the solver published
+ * one since *seen frames, setting *seen to the number of that frame plus one.
+ * Start with *seen = 0. Returns 0 if a frame was copied, 1 otherwise (also if
+ * the solver kept wrapping around onto the frames being copied).
+ */
+int
+ring_latest(struct ring const *ring, double *surface, uint64_t *seen);
+
+/* Whether the solver is done publishing. */
+bool
+ring_done(struct ring const *ring);
+
+/*
+ * Detaches. The solver also marks the ring as done and removes the segment,
+ * viewers which are still attached keep their mapping. Fail-silent.
+ */
+void
+ring_close(struct ring *ring);
@@ -0,0 +1,116 @@
+#!/bin/sh
+#
+# Strong and weak scaling of par on a single machine, oversubscribing it if
+# there are more ranks than cores, so changes to the communication can be
+# measured without a cluster.
+#
+# Usage: ./scaling.sh [PAR [SEQ]]
+#
+# PAR and SEQ are the par and seq binaries (default ./scaling-par and
+# ./scaling-seq, see make scaling). Set in the environment:
+#
+#   RANKS   The rank counts to run with. Default "1 2 4".
+#   SIZES   n of the strong scaling runs. Default "256 512".
+#   WEAK    n of the weak scaling runs with a single rank. With p ranks n is
+#           WEAK * sqrt(p), so every rank has about as many points. Default
+#           256.
+#   ITERS   Iterations of each run. Default 200.
+#   REPEAT  Runs of each, the fastest is kept. Default 3.
+#   MPIRUN  The launcher. Default "mpirun --oversubscribe".
+#
+# Each run writes a single frame, the last, which has to be the same as seq's
+# bit for bit. The times are those of par -t: the run took as long as its
+# slowest rank, and compute, halo and output are the means over the ranks.
+# Strong efficiency is T1 / (p Tp), weak efficiency T1 / Tp, T1 being the run
+# with a single rank.
+#
+# Exits with 1 if a run fails or does not match seq.
+
+PAR=$(realpath "${1:-./scaling-par}") || exit 1
+SEQ=$(realpath "${2:-./scaling-seq}") || exit 1
+RANKS=${RANKS:-"1 2 4"}
+SIZES=${SIZES:-"256 512"}
+WEAK=${WEAK:-256}
+ITERS=${ITERS:-200}
+REPEAT=${REPEAT:-3}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+status=0
+
+# Runs par with $1 ranks on a $2 x $2 plate, REPEAT times, printing "total
+# compute halo output" of the fastest run. Checks the plate against seq's.
+run() {
+  if [ ! -f "seq.$2.bin" ]; then
+    "$SEQ" -n "$2" -i "$ITERS" -f "$ITERS" > /dev/null || return 1
+    mv heat.bin "seq.$2.bin"
+  fi
+  best=
+  k=0
+  while [ "$k" -lt "$REPEAT" ]; do
+    k=$((k + 1))
+    # shellcheck disable=SC2086
+    times=$($MPIRUN -np "$1" "$PAR" -n "$2" -i "$ITERS" -f "$ITERS" -t) ||
+      return 1
+    if ! cmp -s heat.bin "seq.$2.bin"; then
+      echo "par with $1 ranks and n = $2 does not match seq" >&2
+      return 1
+    fi
+    best=$(printf '%s\n' "$times" | awk -v best="$best" '
+      NR > 1 {
+        if ($5 > total) total = $5
+        compute += $2; halo += $3; output += $4; ranks++
+      }
+      END {
+        split(best, b, " ")
+        if (best != "" && b[1] <= total)
+          print best
+        else
+          printf "%.6f %.6f %.6f %.6f\n", total, compute / ranks, halo / ranks,
+              output / ranks
+      }')
+  done
+  echo "$best"
+}
+
+# Prints the table of runs of $1 (strong or weak), one "ranks n total compute
+# halo output" per line on stdin
+table() {
+  awk -v kind="$1" '
+    BEGIN {
+      printf "%5s %6s %10s %10s %10s %10s %8s %10s\n", "ranks", "n", "total",
+          "compute", "halo", "output", "speedup", "efficiency"
+    }
+    {
+      if (NR == 1)
+        t1 = $3
+      speedup = t1 / $3
+      efficiency = kind == "strong" ? speedup / $1 : speedup
+      printf "%5d %6d %10.6f %10.6f %10.6f %10.6f %8.2f %10.2f\n", $1, $2, $3,
+          $4, $5, $6, speedup, efficiency
+    }'
+}
+
+for n in $SIZES; do
+  echo "Strong scaling, n = $n, $ITERS iterations"
+  : > runs
+  for p in $RANKS; do
+    line=$(run "$p" "$n") || { status=1; continue; }
+    echo "$p $n $line" >> runs
+  done
+  table strong < runs
+  echo
+done
+
+echo "Weak scaling, n = $WEAK * sqrt(ranks), $ITERS iterations"
+: > runs
+for p in $RANKS; do
+  n=$(awk -v n="$WEAK" -v p="$p" 'BEGIN { printf "%d\n", n * sqrt(p) + 0.5 }')
+  line=$(run "$p" "$n") || { status=1; continue; }
+  echo "$p $n $line" >> runs
+done
+table weak < runs
+
+exit $status
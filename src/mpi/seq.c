@@ -3,37 +3,32 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include "arena.h"
+#include "libheat.h"
+#include "ring.h"
+#include "stats.h"
+#include "stencil.h"
 #include "shared.c"
 
 #define TAG 1
 
-// copy b into a
-// TODO memcpy
-static void
-copy(double *a, double *b, uint32_t n)
+/* Seconds since some point in the past, for --time */
+static double
+now(void)
 {
-  memcpy(a, b, n * n * sizeof(*a));
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
 }
 
-// Initialize the surface with initial and boundary conditions
+// heat.bin has no padding between rows
 static void
-init(double *surface, uint32_t n)
+write(FILE *f, double *surface, uint32_t n, size_t pitch)
 {
   for (uint32_t i = 0; i < n; i++)
-    for (uint32_t j = 0; j < n; j++)
-      // Boundary condition: Zero at the edges
-      if (i == n - 1 || i == 0 || j == 0 || j == n - 1)
-        surface[i * n + j] = 10.0;
-      // Initial condition: 10
-      else
-        surface[i * n + j] = 0.0;
-}
-
-static void
-write(FILE *f, double *surface, uint32_t n)
-{
-  if (fwrite(surface, sizeof(*surface), n * n, f) != n * n)
-    exit(errno);
+    if (fwrite(surface + i * pitch, sizeof(*surface), n, f) != n)
+      exit(errno);
 }
 
 int
@@ -45,9 +40,11 @@ main(int argc, char **argv)
   args.output = false;
   args.diffusivity = 0.1;
   args.n = 100;
-  args.spacestep = 1 / (double)args.n;
-  args.timestep = (args.spacestep * args.spacestep) / (4 * args.diffusivity);
+  args.spacestep = -1.0;
+  args.timestep = -1.0;
   args.iters = 3000;
+  args.frame_stride = 1;
+  args.safety = 0.9;
   struct argp argp = {
     ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
   };
@@ -56,38 +53,106 @@ main(int argc, char **argv)
     fprintf(stderr, "%s, error while parsing parameters\n", argv[0]);
     return EXIT_FAILURE;
   }
+  enum stencil stencil = args.stencil ? stencil_parse(args.stencil) :
+    STENCIL_5;
+  if (stencil == STENCILS) {
+    fprintf(stderr, "%s, unknown stencil %s\n", argv[0], args.stencil);
+    return EXIT_FAILURE;
+  }
+  if (args.slices) {
+    fprintf(stderr, "%s, -P is only applicable to par\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int stride = timing(&args, stencil, true);
+  if (!stride)
+    return EXIT_FAILURE;
   double alpha = args.diffusivity * (args.timestep / (args.spacestep * args.spacestep));
 
-  FILE *f = fopen("heat.bin", "w");
-  if (!f)
-    exit(errno);
-	double *surface = malloc((size_t)(args.n * args.n) * sizeof(*surface));
+  FILE *f = NULL;
+  struct ring ring;
+  if (args.live) {
+    if (ring_create(&ring, args.live, (uint32_t)args.n))
+      exit(EXIT_FAILURE);
+  } else {
+    f = fopen("heat.bin", "w");
+    if (!f)
+      exit(errno);
+  }
+  struct pyramid pyramid;
+  FILE **levels = NULL;
+  if (args.levels && !args.live) {
+    if (pyramid_init(&pyramid, (size_t)args.n, (size_t)args.n, args.levels))
+      exit(errno);
+    levels = malloc(args.levels * PYRAMID_PLANES * sizeof(*levels));
+    if (!levels || levels_open(levels, args.levels))
+      exit(errno);
+  }
+  /* Both grids come from one (huge page) mapping, with aligned rows */
+  size_t pitch = arena_pitch((size_t)args.n);
+  size_t surface_size = pitch * (size_t)args.n * sizeof(double);
+  struct arena arena;
+  if (arena_init(&arena, 2 * arena_reserve(surface_size)))
+    exit(EXIT_FAILURE);
+	double *surface = arena_alloc(&arena, surface_size);
   if (!surface)
     exit(errno);
-  double *old_surface = malloc((size_t)(args.n * args.n) * sizeof(*old_surface));
+  double *old_surface = arena_alloc(&arena, surface_size);
   if (!old_surface)
     exit(errno);
-  init(surface, args.n);
-  copy(old_surface, surface, args.n);
+  /* The grids swap roles every timestep, see libheat.h */
+  struct heat heat;
+  heat_init(&heat, stencil, surface, old_surface, (size_t)args.n,
+      (size_t)args.n, pitch, alpha);
+  // Boundary condition: 10 at the edges, initial condition: 0
+  heat_fill(&heat, 10.0, 0.0);
+  /* Publishing does nothing without --stats */
+  struct stats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (args.stats && stats_create(&stats, args.stats, 1, (uint64_t)args.iters,
+        args.timestep))
+    exit(EXIT_FAILURE);
+  struct stats_record record = {
+    0, (uint64_t)(args.n - 2) * (uint64_t)(args.n - 2), 0, 0, 0.0, 0.0, 0.0,
+    -1.0
+  };
+  /* Seconds of each phase (there are no halos) and in total */
+  double times[PHASES + 1] = {0.0}, start = now(), mark = start;
 	for (uint32_t iters = 0; iters < args.iters; iters++) {
-      for (uint32_t i = 1; i < args.n - 1; i++) {
-        for (uint32_t j = 1; j < args.n - 1; j++) {
-          uint32_t center = i * args.n + j;
-          uint32_t W = center - 1,
-                   E = center + 1,
-                   N = center - args.n,
-                   S = center + args.n;
-          surface[center] = old_surface[center] + alpha * (old_surface[E] +
-              old_surface[W] - 4 * old_surface[center] + old_surface[S] +
-              old_surface[N]);
-        }
-      }
-    copy(old_surface, surface, args.n);
-    write(f, surface, args.n);
+    heat_strip(&heat, 1, (size_t)args.n - 1, 0.0);
+    heat_swap(&heat);
+    lap(times + PHASE_COMPUTE, &mark, now());
+    record.iters = iters + 1;
+    record.time = (double)(iters + 1) * args.timestep;
+    record.io = times[PHASE_OUTPUT];
+    if (stats_asked(&stats))
+      record.residual = heat_residual(&heat, 1, (size_t)args.n - 1);
+    stats_update(&stats, &record);
+    if ((iters + 1) % (uint32_t)stride)
+      continue;
+    if (args.live)
+      ring_publish(&ring, heat.plate, pitch);
+    else
+      write(f, heat.plate, args.n, pitch);
+    if (levels && levels_write(levels, &pyramid, heat.plate, pitch))
+      exit(errno);
+    lap(times + PHASE_OUTPUT, &mark, now());
+  }
+  times[PHASES] = mark - start;
+  if (args.time)
+    phases_print(times, 1);
+  record.io = times[PHASE_OUTPUT];
+  stats_update(&stats, &record);
+  stats_close(&stats);
+  arena_free(&arena);
+  if (levels) {
+    if (levels_close(levels, args.levels))
+      exit(errno);
+    free(levels);
+    pyramid_free(&pyramid);
   }
-  free(surface);
-  free(old_surface);
-  if (fclose(f))
+  if (args.live)
+    ring_close(&ring);
+  else if (fclose(f))
     exit(errno);
   return EXIT_SUCCESS;
 }
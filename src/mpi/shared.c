@@ -1,10 +1,150 @@
-static double
-max(double **surface, uint32_t n)
-{
-  double ans = surface[0][0];
-  for (uint32_t i = 0; i < n; i++)
-    for (uint32_t j = 0; j < n; j++)
-      if (surface[i][j] > ans)
-        ans = surface[i][j];
+#include "pyramid.h"
+#include "stencil.h"
+#include <limits.h>
+
+/*
+ * Sets the default spacestep and timestep of args for stencil. With --until,
+ * splits it in equal timesteps instead (see stencil_steps), setting
+ * args->iters. Returns the iterations between frames, or 0 if the timestep
+ * given is not stable with --until or the options do not make sense. Problems
+ * are reported to stderr if report.
+ */
+static int
+timing(struct argp_arguments *args, enum stencil stencil, bool report)
+{
+  if (args->frame_time > 0 && !(args->until > 0)) {
+    if (report)
+      fprintf(stderr, "-F is only applicable with -u\n");
+    return 0;
+  }
+  if (args->spacestep < 0)
+    args->spacestep = 1 / (double)args->n;
+  double limit = STENCIL_LIMIT[stencil] * (args->spacestep *
+      args->spacestep) / args->diffusivity;
+  if (args->timestep >= 0 && !stencil_stable(stencil, args->diffusivity *
+        (args->timestep / (args->spacestep * args->spacestep)))) {
+    if (report)
+      fprintf(stderr, "Timestep %g is over the largest stable one, %g, with "
+          "the %s-point stencil%s\n", args->timestep, limit,
+          STENCIL_NAMES[stencil], args->until > 0 ? "" :
+          ": the plate will blow up");
+    if (args->until > 0)
+      return 0;
+  }
+  if (!(args->until > 0)) {
+    if (args->timestep < 0)
+      args->timestep = limit;
+    return args->frame_stride;
+  }
+  uint64_t stride = (uint64_t)args->frame_stride;
+  uint64_t steps = stencil_steps(args->until, args->timestep >= 0 ?
+      args->timestep : args->safety * limit, &args->frame_time, &stride, 1);
+  if (steps > INT_MAX) {
+    if (report)
+      fprintf(stderr, "%" PRIu64 " timesteps are too many\n", steps);
+    return 0;
+  }
+  args->iters = (int)steps;
+  args->timestep = args->until / (double)steps;
+  if (report)
+    fprintf(stderr, "%d timesteps of %g s, a frame every %g s\n",
+        args->iters, args->timestep, (double)stride * args->timestep);
+  return (int)stride;
+}
+
+/* Suffixes of the files each plane of a level goes to */
+static char const *const LEVEL_SUFFIX[PYRAMID_PLANES] = { ".min", ".max", "" };
+
+/*
+ * Opens heat.lK.bin (the means), heat.lK.min.bin and heat.lK.max.bin for
+ * every level K into files (PYRAMID_PLANES per level). Returns 0 on success, 1
+ * on error, leaving errno set. On error, nothing is left open.
+ */
+static int
+levels_open(FILE **files, unsigned levels)
+{
+  char filename[64];
+  for (unsigned i = 0; i < levels * PYRAMID_PLANES; i++) {
+    snprintf(filename, sizeof(filename), "heat.l%u%s.bin", i /
+        PYRAMID_PLANES + 1, LEVEL_SUFFIX[i % PYRAMID_PLANES]);
+    files[i] = fopen(filename, "w");
+    if (!files[i]) {
+      int err = errno;
+      while (i--)
+        fclose(files[i]);
+      errno = err;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Appends every level of the surface, with rows pitch doubles apart, to the
+ * files opened by levels_open. Returns 0 on success, 1 on error, leaving errno
+ * set.
+ */
+static int
+levels_write(FILE **files, struct pyramid *pyramid, double const *surface,
+    size_t pitch)
+{
+  pyramid_build(pyramid, surface, pitch);
+  for (unsigned i = 0; i < pyramid->levels * PYRAMID_PLANES; i++) {
+    unsigned k = i / PYRAMID_PLANES + 1;
+    size_t total = pyramid_dim(pyramid->w, k) * pyramid_dim(pyramid->h, k);
+    if (fwrite(pyramid_plane(pyramid, k, (enum pyramid_plane)(i %
+              PYRAMID_PLANES)), sizeof(double), total, files[i]) != total)
+      return 1;
+  }
+  return 0;
+}
+
+/* Returns 0 on success, 1 on error, leaving errno set. */
+static int
+levels_close(FILE **files, unsigned levels)
+{
+  int ans = 0;
+  for (unsigned i = 0; i < levels * PYRAMID_PLANES; i++)
+    ans |= fclose(files[i]) != 0;
   return ans;
 }
+
+/* Where the time of a run goes, for --time */
+enum phase {
+  PHASE_COMPUTE,
+  /* Posting and waiting for the exchanges of ghost rows */
+  PHASE_HALO,
+  /* Gathering, writing and publishing frames */
+  PHASE_OUTPUT,
+  PHASES
+};
+
+static char const *const PHASE_NAMES[PHASES] = {"compute", "halo", "output"};
+
+/* Adds the time from *mark to now to *phase, moving the mark to now */
+static inline void
+lap(double *phase, double *mark, double now)
+{
+  *phase += now - *mark;
+  *mark = now;
+}
+
+/*
+ * Prints the seconds of each phase and in total of every rank to stdout, a
+ * line per rank after a header, times having PHASES + 1 of them per rank (the
+ * total last)
+ */
+static void
+phases_print(double const *times, int ranks)
+{
+  printf("rank");
+  for (int k = 0; k < PHASES; k++)
+    printf(" %s", PHASE_NAMES[k]);
+  printf(" total\n");
+  for (int r = 0; r < ranks; r++) {
+    printf("%d", r);
+    for (int k = 0; k <= PHASES; k++)
+      printf(" %.6f", times[r * (PHASES + 1) + k]);
+    printf("\n");
+  }
+}
@@ -0,0 +1,387 @@
+#include "amr.h"
+#include "logging.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Points between the rows of a block, ghosts included */
+#define STRIDE(amr) ((ptrdiff_t)(amr)->block + 2)
+
+/* Point (i, j) of block b, -1 <= i, j <= amr->block being the ghosts */
+#define AT(amr, b, i, j) ((b)[((ptrdiff_t)(i) + 1) * STRIDE(amr) +\
+    (ptrdiff_t)(j) + 1])
+
+/*
+ * Position of fine point x between the centres of the n coarse cells: the
+ * first of the two cells to interpolate, into i, and the weight of the second
+ */
+static inline double
+amr_axis(size_t x, size_t n, size_t *i)
+{
+  /* Fine centres are at x + 0.5, coarse ones at 2 * i + 1 */
+  double c = ((double)x - 0.5) / 2;
+  *i = 0;
+  if (n < 2 || c <= 0.0)
+    return 0.0;
+  if (c >= (double)(n - 1)) {
+    *i = n - 2;
+    return 1.0;
+  }
+  *i = (size_t)c;
+  return c - (double)*i;
+}
+
+/* The coarse grid c interpolated at fine point (y, x) */
+static double
+amr_sample(struct amr const *amr, double const *c, DRY(size_t, y, x))
+{
+  size_t i, j;
+  double fy = amr_axis(y, amr->ch, &i), fx = amr_axis(x, amr->cw, &j);
+  size_t i1 = amr->ch < 2 ? i : i + 1, j1 = amr->cw < 2 ? j : j + 1;
+  double top = c[i * amr->cw + j] * (1 - fx) + c[i * amr->cw + j1] * fx;
+  double bottom = c[i1 * amr->cw + j] * (1 - fx) + c[i1 * amr->cw + j1] * fx;
+  return top * (1 - fy) + bottom * fy;
+}
+
+/* Whether fine point (y, x) is on the edge of the plate */
+static inline bool
+amr_edge(struct amr const *amr, DRY(size_t, y, x))
+{
+  return !y || !x || y == amr->h - 1 || x == amr->w - 1;
+}
+
+/* The fixed value of fine point (y, x), on the edge of the plate */
+static inline double
+amr_edge_value(struct amr const *amr, DRY(size_t, y, x))
+{
+  double const *edge = amr->edge;
+  if (!y)
+    return edge[x];
+  if (y == amr->h - 1)
+    return edge[amr->w + x];
+  if (!x)
+    return edge[2 * amr->w + y];
+  return edge[2 * amr->w + amr->h + y];
+}
+
+/* First point and dimensions of block k */
+static inline void
+amr_extent(struct amr const *amr, size_t k, DRY(size_t *, y, x, bh, bw))
+{
+  *y = k / amr->bw * amr->block;
+  *x = k % amr->bw * amr->block;
+  *bh = amr->h - *y < amr->block ? amr->h - *y : amr->block;
+  *bw = amr->w - *x < amr->block ? amr->w - *x : amr->block;
+}
+
+/*
+ * The value of fine point (y, x) at time theta (0 the last coarse step, 1 the
+ * current one) within the coarse step: from its block if refined, otherwise
+ * from the coarse grids
+ */
+static double
+amr_value(struct amr const *amr, DRY(size_t, y, x), double theta)
+{
+  size_t k = y / amr->block * amr->bw + x / amr->block;
+  if (amr->blocks[k])
+    return AT(amr, amr->blocks[k], y % amr->block, x % amr->block);
+  return amr_sample(amr, amr->ocoarse, y, x) * (1 - theta) +
+    amr_sample(amr, amr->coarse, y, x) * theta;
+}
+
+/* Fills the ghost points of block k (those inside the plate) */
+static void
+amr_ghosts(struct amr *amr, size_t k, double theta)
+{
+  size_t y, x, bh, bw;
+  amr_extent(amr, k, &y, &x, &bh, &bw);
+  double *b = amr->blocks[k];
+  for (size_t j = 0; j < bw; j++) {
+    if (y)
+      AT(amr, b, -1, j) = amr_value(amr, y - 1, x + j, theta);
+    if (y + bh < amr->h)
+      AT(amr, b, bh, j) = amr_value(amr, y + bh, x + j, theta);
+  }
+  for (size_t i = 0; i < bh; i++) {
+    if (x)
+      AT(amr, b, i, -1) = amr_value(amr, y + i, x - 1, theta);
+    if (x + bw < amr->w)
+      AT(amr, b, i, bw) = amr_value(amr, y + i, x + bw, theta);
+  }
+}
+
+/* One fine timestep of block k, into its other buffer */
+static void
+amr_step(struct amr *amr, size_t k, double alpha)
+{
+  size_t y, x, bh, bw;
+  amr_extent(amr, k, &y, &x, &bh, &bw);
+  double const *b = amr->blocks[k];
+  double *o = amr->oblocks[k];
+  for (size_t i = 0; i < bh; i++) {
+    for (size_t j = 0; j < bw; j++) {
+      if (amr_edge(amr, y + i, x + j)) {
+        AT(amr, o, i, j) = AT(amr, b, i, j);
+        continue;
+      }
+      AT(amr, o, i, j) = AT(amr, b, i, j) + alpha * (AT(amr, b, i, j + 1) +
+          AT(amr, b, i, j - 1) - 4 * AT(amr, b, i, j) + AT(amr, b, i + 1, j) +
+          AT(amr, b, i - 1, j));
+    }
+  }
+}
+
+/* Averages block k down into the coarse cells it covers */
+static void
+amr_restrict(struct amr *amr, size_t k)
+{
+  size_t y, x, bh, bw;
+  amr_extent(amr, k, &y, &x, &bh, &bw);
+  double const *b = amr->blocks[k];
+  for (size_t i = 0; i < bh; i += 2) {
+    for (size_t j = 0; j < bw; j += 2) {
+      double sum = 0.0, points = 0.0;
+      for (size_t fi = i; fi < i + 2 && fi < bh; fi++)
+        for (size_t fj = j; fj < j + 2 && fj < bw; fj++) {
+          sum += AT(amr, b, fi, fj);
+          points++;
+        }
+      amr->coarse[(y + i) / 2 * amr->cw + (x + j) / 2] = sum / points;
+    }
+  }
+}
+
+/* One coarse timestep, with the alpha of the coarse grid */
+static void
+amr_coarse(struct amr *amr, double alpha)
+{
+  size_t cw = amr->cw, ch = amr->ch;
+  double const *c = amr->coarse;
+  double *o = amr->ocoarse;
+#pragma omp parallel for
+  for (size_t i = 0; i < ch; i++) {
+    for (size_t j = 0; j < cw; j++) {
+      size_t center = i * cw + j;
+      /* Coarse cells on the edge cover points on the edge of the plate */
+      if (!i || !j || i == ch - 1 || j == cw - 1) {
+        o[center] = c[center];
+        continue;
+      }
+      o[center] = c[center] + alpha * (c[center + 1] + c[center - 1] - 4 *
+          c[center] + c[center + cw] + c[center - cw]);
+    }
+  }
+  amr->ocoarse = amr->coarse;
+  amr->coarse = o;
+}
+
+void
+amr_advance(struct amr *amr, unsigned steps, double alpha)
+{
+  /* Twice the spacing, steps times the timestep */
+  amr_coarse(amr, alpha * steps / AMR_SUBCYCLE);
+  for (unsigned s = 0; s < steps; s++) {
+    double theta = (double)s / steps;
+#pragma omp parallel
+    {
+#pragma omp for schedule(dynamic)
+      for (size_t a = 0; a < amr->refined; a++)
+        amr_ghosts(amr, amr->active[a], theta);
+#pragma omp for schedule(dynamic)
+      for (size_t a = 0; a < amr->refined; a++)
+        amr_step(amr, amr->active[a], alpha);
+#pragma omp for
+      for (size_t a = 0; a < amr->refined; a++) {
+        size_t k = amr->active[a];
+        double *swap = amr->blocks[k];
+        amr->blocks[k] = amr->oblocks[k];
+        amr->oblocks[k] = swap;
+      }
+    }
+  }
+#pragma omp parallel for schedule(dynamic)
+  for (size_t a = 0; a < amr->refined; a++)
+    amr_restrict(amr, amr->active[a]);
+}
+
+/* The largest difference between neighbouring coarse cells in block k */
+static double
+amr_gradient(struct amr const *amr, size_t k)
+{
+  size_t y, x, bh, bw;
+  amr_extent(amr, k, &y, &x, &bh, &bw);
+  double ans = 0.0;
+  /* Including the neighbours right of and below the block */
+  for (size_t i = y / 2; i <= (y + bh - 1) / 2 && i < amr->ch; i++) {
+    for (size_t j = x / 2; j <= (x + bw - 1) / 2 && j < amr->cw; j++) {
+      double c = amr->coarse[i * amr->cw + j];
+      if (j + 1 < amr->cw) {
+        double d = amr->coarse[i * amr->cw + j + 1] - c;
+        ans = d > ans ? d : -d > ans ? -d : ans;
+      }
+      if (i + 1 < amr->ch) {
+        double d = amr->coarse[(i + 1) * amr->cw + j] - c;
+        ans = d > ans ? d : -d > ans ? -d : ans;
+      }
+    }
+  }
+  return ans;
+}
+
+/* Refines block k, interpolating it from the coarse grid */
+static int
+amr_refine(struct amr *amr, size_t k)
+{
+  size_t points = (size_t)(STRIDE(amr) * STRIDE(amr));
+  amr->blocks[k] = malloc(points * sizeof(double));
+  amr->oblocks[k] = malloc(points * sizeof(double));
+  if (!amr->blocks[k] || !amr->oblocks[k]) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  size_t y, x, bh, bw;
+  amr_extent(amr, k, &y, &x, &bh, &bw);
+  for (size_t i = 0; i < bh; i++)
+    for (size_t j = 0; j < bw; j++)
+      AT(amr, amr->blocks[k], i, j) = amr_edge(amr, y + i, x + j) ?
+        amr_edge_value(amr, y + i, x + j) : amr_sample(amr, amr->coarse, y +
+            i, x + j);
+  return 0;
+}
+
+int
+amr_regrid(struct amr *amr)
+{
+  size_t blocks = amr->bw * amr->bh;
+  double lo = amr->coarse[0], hi = amr->coarse[0];
+  for (size_t i = 1; i < amr->cw * amr->ch; i++) {
+    lo = amr->coarse[i] < lo ? amr->coarse[i] : lo;
+    hi = amr->coarse[i] > hi ? amr->coarse[i] : hi;
+  }
+  bool *flags = calloc(blocks, sizeof(*flags));
+  if (!flags) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+#pragma omp parallel for
+  for (size_t k = 0; k < blocks; k++)
+    flags[k] = amr_gradient(amr, k) > amr->threshold * (hi - lo);
+  int ans = 1;
+  amr->refined = 0;
+  for (size_t k = 0; k < blocks; k++) {
+    /* Refined if it or any of its neighbours is flagged */
+    size_t by = k / amr->bw, bx = k % amr->bw;
+    bool want = false;
+    for (size_t i = by ? by - 1 : 0; i <= by + 1 && i < amr->bh; i++)
+      for (size_t j = bx ? bx - 1 : 0; j <= bx + 1 && j < amr->bw; j++)
+        want = want || flags[i * amr->bw + j];
+    if (want && !amr->blocks[k] && amr_refine(amr, k))
+      goto regrid_flags;
+    if (!want && amr->blocks[k]) {
+      /* Already averaged down into the coarse grid */
+      free(amr->blocks[k]);
+      free(amr->oblocks[k]);
+      amr->blocks[k] = amr->oblocks[k] = NULL;
+    }
+    if (want)
+      amr->active[amr->refined++] = k;
+  }
+  LOG_INFO("AMR: %zu of %zu blocks refined\n", amr->refined, blocks);
+  ans = 0;
+regrid_flags:
+  free(flags);
+  return ans;
+}
+
+int
+amr_init(struct amr *amr, double const *surface, DRY(size_t, w, h, pitch),
+    size_t block, double threshold)
+{
+  memset(amr, 0, sizeof(*amr));
+  if (!block || block % 2) {
+    LOG_ERROR("AMR: The block size should be even and > 0 (got %zu)\n",
+        block);
+    return 1;
+  }
+  amr->w = w;
+  amr->h = h;
+  amr->cw = (w + 1) / 2;
+  amr->ch = (h + 1) / 2;
+  amr->block = block;
+  amr->bw = (w + block - 1) / block;
+  amr->bh = (h + block - 1) / block;
+  amr->threshold = threshold;
+  size_t blocks = amr->bw * amr->bh;
+  amr->coarse = malloc(amr->cw * amr->ch * sizeof(double));
+  amr->ocoarse = malloc(amr->cw * amr->ch * sizeof(double));
+  amr->blocks = calloc(blocks, sizeof(*amr->blocks));
+  amr->oblocks = calloc(blocks, sizeof(*amr->oblocks));
+  amr->active = malloc(blocks * sizeof(*amr->active));
+  amr->edge = malloc(2 * (w + h) * sizeof(double));
+  if (!amr->coarse || !amr->ocoarse || !amr->blocks || !amr->oblocks ||
+      !amr->active || !amr->edge) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  for (size_t j = 0; j < w; j++) {
+    amr->edge[j] = surface[j];
+    amr->edge[w + j] = surface[(h - 1) * pitch + j];
+  }
+  for (size_t i = 0; i < h; i++) {
+    amr->edge[2 * w + i] = surface[i * pitch];
+    amr->edge[2 * w + h + i] = surface[i * pitch + w - 1];
+  }
+  /* The coarse grid averages the surface down */
+#pragma omp parallel for
+  for (size_t i = 0; i < amr->ch; i++) {
+    for (size_t j = 0; j < amr->cw; j++) {
+      double sum = 0.0, points = 0.0;
+      for (size_t y = 2 * i; y < 2 * i + 2 && y < h; y++)
+        for (size_t x = 2 * j; x < 2 * j + 2 && x < w; x++) {
+          sum += surface[y * pitch + x];
+          points++;
+        }
+      amr->coarse[i * amr->cw + j] = sum / points;
+    }
+  }
+  /* No coarse timestep yet, so the one before is the same */
+  memcpy(amr->ocoarse, amr->coarse, amr->cw * amr->ch * sizeof(double));
+  if (amr_regrid(amr))
+    return 1;
+  /* The refined blocks start with the surface itself */
+  for (size_t a = 0; a < amr->refined; a++) {
+    size_t k = amr->active[a], y, x, bh, bw;
+    amr_extent(amr, k, &y, &x, &bh, &bw);
+    for (size_t i = 0; i < bh; i++)
+      for (size_t j = 0; j < bw; j++)
+        AT(amr, amr->blocks[k], i, j) = surface[(y + i) * pitch + x + j];
+  }
+  return 0;
+}
+
+void
+amr_compose(struct amr const *amr, double *surface, size_t pitch)
+{
+#pragma omp parallel for
+  for (size_t y = 0; y < amr->h; y++)
+    for (size_t x = 0; x < amr->w; x++)
+      surface[y * pitch + x] = amr_edge(amr, y, x) ? amr_edge_value(amr, y,
+          x) : amr_value(amr, y, x, 1.0);
+}
+
+void
+amr_free(struct amr *amr)
+{
+  for (size_t k = 0; amr->blocks && k < amr->bw * amr->bh; k++) {
+    free(amr->blocks[k]);
+    free(amr->oblocks[k]);
+  }
+  free(amr->blocks);
+  free(amr->oblocks);
+  free(amr->coarse);
+  free(amr->ocoarse);
+  free(amr->active);
+  free(amr->edge);
+  memset(amr, 0, sizeof(*amr));
+}
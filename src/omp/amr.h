@@ -0,0 +1,81 @@
+#pragma once
+/*
+ * Block-structured adaptive mesh refinement, for plates whose interesting
+ * parts (steep gradients, near sources and edges) are a small fraction of the
+ * whole. The plate is covered by a coarse grid with half the resolution of
+ * the input (each coarse cell covers 2x2 points of it), and split in blocks of
+ * block x block points. Blocks where the temperature changes steeply are
+ * refined: they also keep every point at the full resolution.
+ *
+ * Timesteps are subcycled: the coarse grid, with twice the spacing, is stable
+ * with four times the timestep, so each coarse step the refined blocks take
+ * AMR_SUBCYCLE (4) steps. The points around a refined block come from its
+ * refined neighbours or, if there are none, are interpolated from the coarse
+ * grid, bilinearly in space and linearly in time between the coarse steps.
+ * After the substeps, the refined blocks are averaged down into the coarse
+ * cells they cover.
+ *
+ * Every now and then the blocks are regridded: a block is refined if the
+ * largest difference between neighbouring coarse cells in it is over
+ * threshold times the range of temperatures of the plate, or if a neighbour
+ * block is (so features do not leave the refined region between regrids).
+ * Newly refined blocks are interpolated from the coarse grid.
+ *
+ * The points on the edges of the plate never change, as in the uniform grid.
+ */
+#include "dry.h"
+#include <stddef.h>
+
+/* Fine steps per coarse step */
+#define AMR_SUBCYCLE 4
+
+struct amr {
+  /* The plate, at full resolution */
+  size_t w, h;
+  /* The coarse grid, and the coarse grid as of the last coarse step */
+  double *coarse, *ocoarse;
+  size_t cw, ch;
+  /* Blocks, bw x bh of them. NULL if not refined, otherwise block + 2 rows of
+   * block + 2 points (with a ring of ghost points around), twice */
+  double **blocks, **oblocks;
+  size_t block, bw, bh;
+  /* The refined blocks, refined of them */
+  size_t *active, refined;
+  /* The edges of the plate: top and bottom rows, left and right columns */
+  double *edge;
+  double threshold;
+};
+
+/*
+ * Sets up the AMR of the w x h surface (rows pitch doubles apart), refining
+ * the blocks of block x block points (even) as described above. Returns 0 on
+ * success, 1 on error, reporting the error to stderr. On error, call amr_free
+ * anyway.
+ */
+int
+amr_init(struct amr *amr, double const *surface, DRY(size_t, w, h, pitch),
+    size_t block, double threshold);
+
+/*
+ * Advances steps (<= AMR_SUBCYCLE) fine timesteps, as a single coarse step.
+ * alpha is that of the fine timestep.
+ */
+void
+amr_advance(struct amr *amr, unsigned steps, double alpha);
+
+/*
+ * Refines and coarsens blocks as described above. Returns 0 on success, 1 on
+ * error, reporting the error to stderr.
+ */
+int
+amr_regrid(struct amr *amr);
+
+/*
+ * Writes the plate at full resolution to surface (rows pitch doubles apart),
+ * interpolating the blocks that are not refined from the coarse grid.
+ */
+void
+amr_compose(struct amr const *amr, double *surface, size_t pitch);
+
+void
+amr_free(struct amr *amr);
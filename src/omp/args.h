@@ -15,11 +15,76 @@ static char const ARGP_DOC[] = "Calculates heat dissipation on a 2D surface "
 static char const ARGP_DOCA[] = "FILENAME";
 static struct argp_option const ARGP_OPT[] = {
   {"output", 'o', NULL, OPTION_ARG_OPTIONAL, "Output .ppms.", 0},
+  {"levels", 'L', "LEVELS", 0, "Also output LEVELS downsampled levels (2x, "
+    "4x, ...) of each iteration as itX.lK.ppm (only applicable if called with "
+    "-o). Default 0.", 0},
+  {"probe", 'P', "SPEC", 0, "Write the time series of the cells described by "
+    "SPEC (point:X,Y, line:X0,Y0,X1,Y1 or rect:X0,Y0,X1,Y1) to probeK.bin, "
+    "for the K-th probe given. Can be given multiple times.", 0},
+  {"probe-stride", 'r', "ITERS", 0, "Sample probes every ITERS iterations. "
+    "Default 1.", 0},
+  {"frame-stride", 'f', "ITERS", 0, "Output a .ppm every ITERS iterations "
+    "(only applicable if called with -o). Default 1.", 0},
+  {"quantise", 'q', "FORMAT", 0, "Store buffered frames as FORMAT: double, "
+    "u16 or u8 (scaled to the max of each frame) or rgb (colour mapped when "
+    "captured). Smaller formats fit more frames in the buffer, but u16, u8 "
+    "and rgb do not support -L (only applicable if called with -o). Default "
+    "double.", 0},
+  {"container", 'c', "FILE", 0, "Append the frames to the single indexed "
+    "container FILE (see extract) instead of writing an itX.ppm per frame. "
+    "Does not support -L (only applicable if called with -o).", 0},
+  {"direct", 'D', NULL, 0, "Write the container with O_DIRECT, bypassing the "
+    "page cache (only applicable if called with -c).", 0},
   {"buffer", 'b', "BYTES", 0, "Output buffer size (only applicable if called with -o). Default 512MB.", 0},
+  {"lean", 'm', NULL, 0, "Update a single grid in place instead of keeping "
+    "two, halving memory for large plates (same results).", 0},
+  {"out-of-core", 'O', "FILE", 0, "Keep the plate in FILE instead of in "
+    "memory, for plates larger than RAM, streaming it through memory once "
+    "per pass. FILE is left with the final plate (h rows of w doubles). Does "
+    "not support -o, -P or -m.", 0},
+  {"skew", 'k', "STEPS", 0, "Timesteps advanced per pass over the file "
+    "(only applicable if called with -O). Default 8.", 0},
+  {"amr", 'a', "BLOCK", 0, "Adaptive mesh refinement: keep the plate at half "
+    "the resolution, except for the blocks of BLOCK x BLOCK cells (even) where "
+    "it changes steeply, which take 4 timesteps per coarse timestep. Strides "
+    "should be multiples of 4. Approximate results, does not support -m or "
+    "-O. Default 0 (off).", 0},
+  {"refine", 'g', "FRACTION", 0, "Refine the blocks where neighbouring cells "
+    "differ by over FRACTION of the range of temperatures (only applicable if "
+    "called with -a). Default is 0.05.", 0},
+  {"regrid", 'R', "STEPS", 0, "Choose the refined blocks every STEPS coarse "
+    "timesteps (only applicable if called with -a). Default 4.", 0},
+  {"stencil", 'S', "POINTS", 0, "Discretise with the POINTS-point stencil: 5 "
+    "(second order), 9 (compact, isotropic second order) or 13 (fourth "
+    "order). 9 and 13 do not support -m, -O or -a. Default 5.", 0},
+  {"tune", 't', NULL, 0, "Time short trials of thread counts and tiles on "
+    "this plate before running, and keep the fastest in a cache for "
+    "later runs on this machine, which use it without -t (see tune.h). Does "
+    "not support -m, -O or -a.", 0},
+  {"spectral", 'e', NULL, 0, "Jump straight from each frame or probe sample "
+    "to the next with the exact solution in time, in the sine basis (see "
+    "spectral.h), at the same cost however many iterations apart they are. "
+    "Only with the 5 and 9-point stencils, does not support -m, -O, -a or "
+    "-t.", 0},
   {"iterations", 'i', "ITERS", 0, "Number of iterations. Default is 1000.", 0},
+  {"until", 'u', "SECONDS", 0, "Run until SECONDS of simulated time instead "
+    "of -i iterations, in equal timesteps of at most -s (or the largest "
+    "stable one times -x), the plate at SECONDS included.", 0},
+  {"safety", 'x', "FRACTION", 0, "Fraction of the largest stable timestep "
+    "taken by default (only applicable if called with -u). Default 0.9.", 0},
+  {"frame-time", 'F', "SECONDS", 0, "Output a frame every SECONDS of "
+    "simulated time instead of every -f iterations (only applicable if called "
+    "with -u).", 0},
+  {"probe-time", 'T', "SECONDS", 0, "Sample probes every SECONDS of "
+    "simulated time instead of every -r iterations (only applicable if called "
+    "with -u).", 0},
+  {"stats", 'M', "NAME", 0, "Publish live metrics to the shared memory "
+    "segment NAME (e.g. /heatstat) for heatstat while running.", 0},
   {"spacestep", 'p', "METERS", 0, "Spacestep. Default 1/w.", 0},
   {"diffusivity", 'd', "J/ M3 K", 0, "Diffusivity. Default is 0.1.", 0},
-  {"timestep", 's', "SECONDS", 0, "Timestep. Default spacestep2 / (4 diffusivity).", 0},
+  {"timestep", 's', "SECONDS", 0, "Timestep. Default the largest stable one, "
+    "spacestep2 / (4 diffusivity) with the 5-point stencil. Unstable ones are "
+    "warned about, or refused with -u.", 0},
   { 0 }
 };
 
@@ -29,10 +94,15 @@ struct argp_arguments {
 #else
   char *input[ARGP_N_ARGS];
 #endif
-  uint64_t iters;
-  size_t bsize;
-  double timestep, spacestep, diffusivity;
-  bool output;
+  uint64_t iters, probe_stride, frame_stride, regrid;
+  char **probes;
+  size_t nprobes;
+  char *format, *container, *ooc, *stencil, *stats;
+  size_t bsize, amr;
+  unsigned levels, skew;
+  double timestep, spacestep, diffusivity, refine;
+  double until, safety, frame_time, probe_time;
+  bool output, direct, lean, tune, spectral;
 };
 
 #define ASSERTSTRTO(nptr, endptr)\
@@ -64,6 +134,79 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
       arguments->bsize = (size_t)strtoull(arg, &endptr, 10);
       ASSERTSTRTO(arg, endptr);
       break;
+    case 'c':
+      arguments->container = arg;
+      break;
+    case 'D':
+      arguments->direct = true;
+      break;
+    case 'm':
+      arguments->lean = true;
+      break;
+    case 't':
+      arguments->tune = true;
+      break;
+    case 'e':
+      arguments->spectral = true;
+      break;
+    case 'O':
+      arguments->ooc = arg;
+      break;
+    case 'k':
+      arguments->skew = (unsigned)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (!arguments->skew)
+        argp_error(state, "The skew should be > 0");
+      break;
+    case 'a':
+      arguments->amr = (size_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (arguments->amr % 2)
+        argp_error(state, "The AMR block size should be even");
+      break;
+    case 'g':
+      arguments->refine = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'R':
+      arguments->regrid = (uint64_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (!arguments->regrid)
+        argp_error(state, "The regrid interval should be > 0");
+      break;
+    case 'S':
+      arguments->stencil = arg;
+      break;
+    case 'q':
+      arguments->format = arg;
+      break;
+    case 'L':
+      arguments->levels = (unsigned)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'P': {
+      char **probes = realloc(arguments->probes, (arguments->nprobes + 1) *
+          sizeof(*probes));
+      if (!probes) {
+        fprintf(stderr, "Could not add probe %s: %s.\n", arg, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      probes[arguments->nprobes++] = arg;
+      arguments->probes = probes;
+      break;
+    }
+    case 'r':
+      arguments->probe_stride = (uint64_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (!arguments->probe_stride)
+        argp_error(state, "The probe stride should be > 0");
+      break;
+    case 'f':
+      arguments->frame_stride = (uint64_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (!arguments->frame_stride)
+        argp_error(state, "The frame stride should be > 0");
+      break;
     case 'p':
       arguments->spacestep = strtod(arg, &endptr);
       ASSERTSTRTO(arg, endptr);
@@ -72,6 +215,33 @@ argp_parse_options(int key, char *arg, struct argp_state *state)
       arguments->diffusivity = strtod(arg, &endptr);
       ASSERTSTRTO(arg, endptr);
       break;
+    case 'u':
+      arguments->until = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->until > 0))
+        argp_error(state, "The simulated time should be > 0");
+      break;
+    case 'x':
+      arguments->safety = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->safety > 0 && arguments->safety <= 1))
+        argp_error(state, "The safety factor should be in (0, 1]");
+      break;
+    case 'F':
+      arguments->frame_time = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->frame_time > 0))
+        argp_error(state, "The frame time should be > 0");
+      break;
+    case 'M':
+      arguments->stats = arg;
+      break;
+    case 'T':
+      arguments->probe_time = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->probe_time > 0))
+        argp_error(state, "The probe time should be > 0");
+      break;
     case 'i':
       arguments->iters = (uint64_t)strtoull(arg, &endptr, 10);
       ASSERTSTRTO(arg, endptr);
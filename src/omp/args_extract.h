@@ -0,0 +1,84 @@
+#pragma once
+/* for strtoull */
+#define _POSIX_C_SOURCE 200112L
+#include <argp.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ARGP_FLAGS 0
+#define ARGP_INDEX 0
+#define ARGP_N_ARGS 1
+static char const ARGP_DOC[] = "Extracts the frames of a container written by "
+  "heat -o -c, as itX.ppm files or as a Y4M video on stdout.";
+static char const ARGP_DOCA[] = "CONTAINER";
+static struct argp_option const ARGP_OPT[] = {
+  {"first", 'f', "FRAME", 0, "First frame to extract (its position in the "
+    "container, not its iteration). Default 0.", 0},
+  {"frames", 'n', "FRAMES", 0, "Number of frames to extract. Default all.", 0},
+  {"y4m", 'y', NULL, 0, "Write the frames as a Y4M video to stdout (e.g. "
+    "for ffmpeg -i -) instead of .ppms.", 0},
+  {"fps", 'r', "FPS", 0, "Frame rate of the Y4M video. Default 25.", 0},
+  {"list", 'l', NULL, 0, "Only list the frames: position, iteration and max "
+    "temperature.", 0},
+  { 0 }
+};
+
+struct argp_arguments {
+  char *input[ARGP_N_ARGS];
+  uint64_t first, frames;
+  unsigned fps;
+  bool y4m, list;
+};
+
+#define ASSERTSTRTO(nptr, endptr)\
+  do {\
+    if (errno || (endptr) == (nptr)) {\
+      fprintf(stderr, "Invalid argument: %s. Error: %s.\n", (nptr), errno ?\
+          strerror(errno) : "No digits were found");\
+      exit(EXIT_FAILURE);\
+    }\
+  } while(0)
+
+static error_t
+argp_parse_options(int key, char *arg, struct argp_state *state)
+{
+  struct argp_arguments *arguments = (struct argp_arguments *)(state->input);
+  char *endptr = NULL;
+  errno = 0;
+  switch(key) {
+    case 'f':
+      arguments->first = (uint64_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'n':
+      arguments->frames = (uint64_t)strtoull(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      break;
+    case 'y':
+      arguments->y4m = true;
+      break;
+    case 'r':
+      arguments->fps = (unsigned)strtoul(arg, &endptr, 10);
+      ASSERTSTRTO(arg, endptr);
+      if (!arguments->fps)
+        argp_error(state, "The frame rate should be > 0");
+      break;
+    case 'l':
+      arguments->list = true;
+      break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= ARGP_N_ARGS)
+        argp_usage(state);
+      arguments->input[state->arg_num] = arg;
+      break;
+    case ARGP_KEY_END:
+      if (state->arg_num < ARGP_N_ARGS)
+        argp_usage(state);
+      return 0;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
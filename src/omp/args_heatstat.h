@@ -0,0 +1,76 @@
+#pragma once
+/* for strtod */
+#define _POSIX_C_SOURCE 200112L
+#include <argp.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ARGP_FLAGS 0
+#define ARGP_INDEX 0
+#define ARGP_N_ARGS 1
+static char const ARGP_DOC[] = "Shows the live metrics of a run of heat, seq "
+  "or par started with --stats=NAME, one line per rank: iterations, "
+  "Mcells/s, residual, output buffer fill, seconds stalled on output and on "
+  "halos, and whether it is running, stalled (no iterations since the last "
+  "sample), dead or done.";
+static char const ARGP_DOCA[] = "NAME";
+static struct argp_option const ARGP_OPT[] = {
+  {"delay", 'd', "SECONDS", 0, "Seconds between samples, which rates are "
+    "measured over. Default 1.", 0},
+  {"watch", 'w', NULL, 0, "Keep printing every -d seconds until the run is "
+    "done, instead of once.", 0},
+  {"residual", 'r', NULL, 0, "Ask the ranks for their residual (the max "
+    "change of a point over a timestep) every sample, which costs them about "
+    "a timestep each time.", 0},
+  { 0 }
+};
+
+struct argp_arguments {
+  char *input[ARGP_N_ARGS];
+  double delay;
+  bool watch, residual;
+};
+
+#define ASSERTSTRTO(nptr, endptr)\
+  do {\
+    if (errno || (endptr) == (nptr)) {\
+      fprintf(stderr, "Invalid argument: %s. Error: %s.\n", (nptr), errno ?\
+          strerror(errno) : "No digits were found");\
+      exit(EXIT_FAILURE);\
+    }\
+  } while(0)
+
+static error_t
+argp_parse_options(int key, char *arg, struct argp_state *state)
+{
+  struct argp_arguments *arguments = (struct argp_arguments *)(state->input);
+  char *endptr = NULL;
+  errno = 0;
+  switch(key) {
+    case 'd':
+      arguments->delay = strtod(arg, &endptr);
+      ASSERTSTRTO(arg, endptr);
+      if (!(arguments->delay > 0))
+        argp_error(state, "The delay should be > 0");
+      break;
+    case 'w':
+      arguments->watch = true;
+      break;
+    case 'r':
+      arguments->residual = true;
+      break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= ARGP_N_ARGS)
+        argp_usage(state);
+      arguments->input[state->arg_num] = arg;
+      break;
+    case ARGP_KEY_END:
+      if (state->arg_num < ARGP_N_ARGS)
+        argp_usage(state);
+      return 0;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
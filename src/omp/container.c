@@ -0,0 +1,275 @@
+/* for O_DIRECT */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include "container.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* size rounded up to CONTAINER_BLOCK */
+static size_t
+container_round(size_t size)
+{
+  return (size + CONTAINER_BLOCK - 1) / CONTAINER_BLOCK * CONTAINER_BLOCK;
+}
+
+size_t
+container_slot(size_t frame_size)
+{
+  return container_round(frame_size);
+}
+
+/* pwrite, resuming after partial writes. Returns 0 on success, 1 on error. */
+static int
+container_pwrite(int fd, void const *buf, size_t size, off_t offset)
+{
+  char const *p = buf;
+  while (size) {
+    ssize_t rc = pwrite(fd, p, size, offset);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return 1;
+    p += rc;
+    size -= (size_t)rc;
+    offset += rc;
+  }
+  return 0;
+}
+
+/* pread, resuming after partial reads. Returns 0 on success, 1 on error. */
+static int
+container_pread(int fd, void *buf, size_t size, off_t offset)
+{
+  char *p = buf;
+  while (size) {
+    ssize_t rc = pread(fd, p, size, offset);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0) {
+      if (!rc)
+        errno = EIO;
+      return 1;
+    }
+    p += rc;
+    size -= (size_t)rc;
+    offset += rc;
+  }
+  return 0;
+}
+
+/*
+ * Allocates the in memory header and index of a container with room for
+ * capacity frames. Returns 0 on success, 1 on error (with errno set).
+ */
+static int
+container_head(struct container *container, uint64_t capacity)
+{
+  if (capacity > (SIZE_MAX - sizeof(struct container_header) -
+        CONTAINER_BLOCK) / sizeof(struct container_entry)) {
+    errno = EOVERFLOW;
+    return 1;
+  }
+  container->head_size = container_round(sizeof(struct container_header) +
+      (size_t)capacity * sizeof(struct container_entry));
+  void *head;
+  /* Written along with the frames, so it has to be aligned for O_DIRECT */
+  int rc = posix_memalign(&head, CONTAINER_BLOCK, container->head_size);
+  if (rc) {
+    errno = rc;
+    return 1;
+  }
+  memset(head, 0, container->head_size);
+  container->header = head;
+  container->index = (struct container_entry *)(container->header + 1);
+  return 0;
+}
+
+int
+container_create(struct container *container, char const *filename,
+    unsigned format, DRY(size_t, w, h, frame_size), uint64_t capacity,
+    bool direct)
+{
+  memset(container, 0, sizeof(*container));
+  container->fd = -1;
+  container->write = true;
+  if (container_head(container, capacity)) {
+    LOG_ERROR("%s: Index for %"PRIu64" frames: %s\n", filename, capacity,
+        strerror(errno));
+    goto create_return;
+  }
+  struct container_header *header = container->header;
+  memcpy(header->magic, CONTAINER_MAGIC, sizeof(header->magic));
+  header->format = format;
+  header->w = w;
+  header->h = h;
+  header->frame_size = frame_size;
+  header->slot_size = container_slot(frame_size);
+  header->capacity = capacity;
+  header->data = container->head_size;
+  if (header->slot_size && capacity > (UINT64_MAX - header->data) /
+      header->slot_size) {
+    LOG_ERROR("%s: %"PRIu64" frames do not fit a file\n", filename, capacity);
+    goto create_head;
+  }
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+  if (direct) {
+    container->fd = open(filename, flags | O_DIRECT, 0644);
+    /* Some filesystems (e.g. tmpfs) do not support it */
+    if (container->fd < 0 && errno == EINVAL)
+      LOG_WARNING("%s: O_DIRECT not supported, using the page cache\n",
+          filename);
+  }
+#else
+  if (direct)
+    LOG_WARNING("%s: O_DIRECT not available, using the page cache\n",
+        filename);
+#endif
+  if (container->fd < 0)
+    container->fd = open(filename, flags, 0644);
+  if (container->fd < 0) {
+    LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    goto create_head;
+  }
+  /* Reserve the blocks now, so appends do not have to allocate them */
+  off_t size = (off_t)(header->data + capacity * header->slot_size);
+  int rc = posix_fallocate(container->fd, 0, size);
+  if (rc == EINVAL || rc == EOPNOTSUPP) {
+    LOG_INFO("%s: Could not preallocate: %s\n", filename, strerror(rc));
+    rc = ftruncate(container->fd, size) ? errno : 0;
+  }
+  if (rc) {
+    LOG_ERROR("%s: Could not allocate %lld bytes: %s\n", filename,
+        (long long)size, strerror(rc));
+    goto create_open;
+  }
+  if (container_pwrite(container->fd, container->header, container->head_size,
+        0)) {
+    LOG_ERROR("%s: Could not write header: %s\n", filename, strerror(errno));
+    goto create_open;
+  }
+  return 0;
+create_open:
+  close(container->fd);
+create_head:
+  free(container->header);
+create_return:
+  memset(container, 0, sizeof(*container));
+  container->fd = -1;
+  return 1;
+}
+
+int
+container_append(struct container *container, void const *frames,
+    double const *mvals, uint64_t n, DRY(uint64_t, first, stride))
+{
+  struct container_header *header = container->header;
+  if (n > header->capacity - header->count) {
+    LOG_ERROR("Container full, could not append %"PRIu64" frames\n", n);
+    return 1;
+  }
+  /* All the frames in a single write */
+  if (container_pwrite(container->fd, frames, (size_t)(n * header->slot_size),
+        (off_t)(header->data + header->count * header->slot_size))) {
+    LOG_ERROR("Container: Could not write %"PRIu64" frames: %s\n", n,
+        strerror(errno));
+    return 1;
+  }
+  size_t from = (size_t)((char *)(container->index + header->count) -
+      (char *)header) / CONTAINER_BLOCK * CONTAINER_BLOCK;
+  for (uint64_t i = 0; i < n; i++) {
+    container->index[header->count].iter = (first + i) * stride;
+    container->index[header->count].mval = mvals[i];
+    header->count++;
+  }
+  size_t to = container_round((size_t)((char *)(container->index +
+          header->count) - (char *)header));
+  /* Only the blocks of the index that changed, and the header */
+  if (container_pwrite(container->fd, (char *)header + from, to - from,
+        (off_t)from) || (from && container_pwrite(container->fd, header,
+            CONTAINER_BLOCK, 0))) {
+    LOG_ERROR("Container: Could not write index: %s\n", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+int
+container_open(struct container *container, char const *filename)
+{
+  memset(container, 0, sizeof(*container));
+  container->fd = open(filename, O_RDONLY);
+  if (container->fd < 0) {
+    LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    goto open_return;
+  }
+  struct container_header header;
+  if (container_pread(container->fd, &header, sizeof(header), 0)) {
+    LOG_ERROR("%s: Could not read header: %s\n", filename, strerror(errno));
+    goto open_open;
+  }
+  if (memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic))) {
+    LOG_ERROR("%s: Not a container (wrong magic number)\n", filename);
+    goto open_open;
+  }
+  if (header.count > header.capacity || container_head(container,
+        header.capacity) || header.data != container->head_size ||
+      header.slot_size != container_slot(header.frame_size)) {
+    LOG_ERROR("%s: Corrupted header\n", filename);
+    goto open_head;
+  }
+  if (container_pread(container->fd, container->header, container->head_size,
+        0)) {
+    LOG_ERROR("%s: Could not read index: %s\n", filename, strerror(errno));
+    goto open_head;
+  }
+  return 0;
+open_head:
+  free(container->header);
+open_open:
+  close(container->fd);
+open_return:
+  memset(container, 0, sizeof(*container));
+  container->fd = -1;
+  return 1;
+}
+
+int
+container_read(struct container *container, uint64_t k, void *frame)
+{
+  struct container_header *header = container->header;
+  if (container_pread(container->fd, frame, (size_t)header->frame_size,
+        (off_t)(header->data + k * header->slot_size))) {
+    LOG_ERROR("Container: Could not read frame %"PRIu64": %s\n", k,
+        strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+int
+container_close(struct container *container)
+{
+  int ans = 0;
+  struct container_header *header = container->header;
+  if (container->write && header->count < header->capacity &&
+      ftruncate(container->fd, (off_t)(header->data + header->count *
+          header->slot_size))) {
+    LOG_ERROR("Container: Could not trim: %s\n", strerror(errno));
+    ans = 1;
+  }
+  if (close(container->fd)) {
+    LOG_ERROR("Container: Could not close: %s\n", strerror(errno));
+    ans = 1;
+  }
+  free(container->header);
+  memset(container, 0, sizeof(*container));
+  container->fd = -1;
+  return ans;
+}
@@ -0,0 +1,103 @@
+#pragma once
+/*
+ * Container: every frame of a run in a single file, instead of one .ppm per
+ * frame, which for long runs means too many files for the filesystem. It is
+ * laid out as
+ *
+ *   header | index | frames
+ *
+ * The header (struct container_header) and the index (a struct
+ * container_entry per frame, with its iteration and max temperature) take the
+ * first CONTAINER_BLOCK multiple of bytes. Frames (see frame.h) follow, each
+ * in a slot of slot_size bytes, frame_size rounded up to CONTAINER_BLOCK. So
+ * any frame can be read with a single pread, and frames are written with
+ * large aligned writes (possibly with O_DIRECT), never touching the page
+ * cache. Everything is in the machine's byte order.
+ *
+ * The file is preallocated for every frame of the run. The header and the
+ * index are rewritten after each batch of frames, so if heat dies midway the
+ * frames written so far are still readable.
+ */
+#include "dry.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONTAINER_MAGIC "HEATCNT1"
+/* Alignment of the slots in the file and of the frame buffer in memory */
+#define CONTAINER_BLOCK 4096
+
+struct container_header {
+  char magic[8];
+  /* enum format of frame.h */
+  uint32_t format;
+  uint32_t reserved;
+  uint64_t w, h;
+  uint64_t frame_size, slot_size;
+  /* Frames the file has room for and frames written */
+  uint64_t capacity, count;
+  /* Offset of the first slot */
+  uint64_t data;
+};
+
+struct container_entry {
+  uint64_t iter;
+  double mval;
+};
+
+struct container {
+  int fd;
+  /* The header and the index, as in the start of the file */
+  struct container_header *header;
+  struct container_entry *index;
+  size_t head_size;
+  bool write;
+};
+
+/* Bytes a frame_size bytes frame takes in the container (and its buffer) */
+size_t
+container_slot(size_t frame_size);
+
+/*
+ * Creates the container filename for capacity w x h frames of frame_size bytes
+ * stored as format, truncating it if it exists, and preallocates it. If direct,
+ * frames are written with O_DIRECT (if the filesystem supports it). Returns 0
+ * on success, 1 on error, reporting the error to stderr. On error, nothing is
+ * left open.
+ */
+int
+container_create(struct container *container, char const *filename,
+    unsigned format, DRY(size_t, w, h, frame_size), uint64_t capacity,
+    bool direct);
+
+/*
+ * Appends n frames, taken every stride iters starting at iteration first *
+ * stride, with maxes mvals. The frames are in slots of slot_size bytes, one
+ * after the other, from a buffer aligned to CONTAINER_BLOCK. Returns 0 on
+ * success, 1 on error, reporting the error to stderr.
+ */
+int
+container_append(struct container *container, void const *frames,
+    double const *mvals, uint64_t n, DRY(uint64_t, first, stride));
+
+/*
+ * Opens the container filename for reading. Returns 0 on success, 1 on error,
+ * reporting the error to stderr. On error, nothing is left open.
+ */
+int
+container_open(struct container *container, char const *filename);
+
+/*
+ * Reads frame k (k < header->count) into frame, which has room for frame_size
+ * bytes. Returns 0 on success, 1 on error, reporting the error to stderr.
+ */
+int
+container_read(struct container *container, uint64_t k, void *frame);
+
+/*
+ * Closes the container, trimming the preallocated room for frames that were
+ * never written. Returns 0 on success, 1 on error, reporting the error to
+ * stderr. The container is closed either way.
+ */
+int
+container_close(struct container *container);
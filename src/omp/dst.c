@@ -0,0 +1,137 @@
+#include "dst.h"
+#include "logging.h"
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DST_PI 3.14159265358979323846
+
+static inline struct dst_complex
+dst_mul(struct dst_complex a, struct dst_complex b)
+{
+  struct dst_complex ans = {
+    a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re
+  };
+  return ans;
+}
+
+static inline struct dst_complex
+dst_polar(double angle)
+{
+  struct dst_complex ans = {cos(angle), sin(angle)};
+  return ans;
+}
+
+/*
+ * The FFT of the l points a (l a power of 2, twiddles those of dst_init) in
+ * place, or the inverse FFT times l if inverse
+ */
+static void
+dst_fft(struct dst_complex *a, size_t l, struct dst_complex const *twiddles,
+    bool inverse)
+{
+  /* Bit reversed order */
+  for (size_t i = 1, j = 0; i < l; i++) {
+    size_t bit = l >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j |= bit;
+    if (i < j) {
+      struct dst_complex swap = a[i];
+      a[i] = a[j];
+      a[j] = swap;
+    }
+  }
+  for (size_t len = 2; len <= l; len <<= 1) {
+    size_t half = len / 2, step = l / len;
+    for (size_t i = 0; i < l; i += len)
+      for (size_t k = 0; k < half; k++) {
+        struct dst_complex w = twiddles[k * step];
+        if (inverse)
+          w.im = -w.im;
+        struct dst_complex u = a[i + k], v = dst_mul(a[i + k + half], w);
+        a[i + k].re = u.re + v.re;
+        a[i + k].im = u.im + v.im;
+        a[i + k + half].re = u.re - v.re;
+        a[i + k + half].im = u.im - v.im;
+      }
+  }
+}
+
+int
+dst_init(struct dst *dst, size_t n)
+{
+  memset(dst, 0, sizeof(*dst));
+  dst->n = n;
+  dst->m = 2 * (n + 1);
+  bool direct = !(dst->m & (dst->m - 1));
+  dst->l = dst->m;
+  if (!direct)
+    for (dst->l = 1; dst->l < 2 * dst->m - 1; dst->l <<= 1)
+      ;
+  dst->twiddles = malloc(dst->l / 2 * sizeof(*dst->twiddles));
+  if (!direct) {
+    dst->chirp = malloc(dst->m * sizeof(*dst->chirp));
+    dst->kernel = calloc(dst->l, sizeof(*dst->kernel));
+  }
+  if (!dst->twiddles || (!direct && (!dst->chirp || !dst->kernel))) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  for (size_t k = 0; k < dst->l / 2; k++)
+    dst->twiddles[k] = dst_polar(-2 * DST_PI * (double)k / (double)dst->l);
+  if (direct)
+    return 0;
+  /* k^2 modulo 2 m, the period of the chirp, keeps the angles small */
+  for (size_t k = 0; k < dst->m; k++)
+    dst->chirp[k] = dst_polar(-DST_PI * (double)(k * k % (2 * dst->m)) /
+        (double)dst->m);
+  for (size_t k = 0; k < dst->m; k++) {
+    struct dst_complex c = {dst->chirp[k].re, -dst->chirp[k].im};
+    dst->kernel[k] = c;
+    if (k)
+      dst->kernel[dst->l - k] = c;
+  }
+  dst_fft(dst->kernel, dst->l, dst->twiddles, false);
+  return 0;
+}
+
+void
+dst_apply(struct dst const *dst, double *x, ptrdiff_t stride, struct
+    dst_complex *work)
+{
+  size_t n = dst->n, m = dst->m, l = dst->l;
+  /* The odd extension */
+  memset(work, 0, l * sizeof(*work));
+  for (size_t j = 0; j < n; j++) {
+    work[j + 1].re = x[(ptrdiff_t)j * stride];
+    work[m - 1 - j].re = -x[(ptrdiff_t)j * stride];
+  }
+  if (!dst->chirp) {
+    dst_fft(work, l, dst->twiddles, false);
+  } else {
+    for (size_t k = 0; k < m; k++)
+      work[k] = dst_mul(work[k], dst->chirp[k]);
+    dst_fft(work, l, dst->twiddles, false);
+    for (size_t k = 0; k < l; k++)
+      work[k] = dst_mul(work[k], dst->kernel[k]);
+    dst_fft(work, l, dst->twiddles, true);
+    for (size_t k = 1; k <= n; k++) {
+      work[k] = dst_mul(work[k], dst->chirp[k]);
+      work[k].im /= (double)l;
+    }
+  }
+  /* The FFT of the odd extension is -2 i y */
+  for (size_t k = 0; k < n; k++)
+    x[(ptrdiff_t)k * stride] = -work[k + 1].im / 2;
+}
+
+void
+dst_free(struct dst *dst)
+{
+  free(dst->twiddles);
+  free(dst->chirp);
+  free(dst->kernel);
+}
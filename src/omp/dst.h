@@ -0,0 +1,50 @@
+#pragma once
+/*
+ * Fast discrete sine transform (DST-I) of any length n, for the spectral
+ * engine (see spectral.h):
+ *
+ *   y[k] = sum over j < n of x[j] sin(pi (j + 1) (k + 1) / (n + 1)), k < n
+ *
+ * Applied twice it gives back x times (n + 1) / 2, so it is its own inverse
+ * but for that factor.
+ *
+ * It is computed from the FFT of the odd extension of x, 0 x[0] ... x[n-1] 0
+ * -x[n-1] ... -x[0], whose length m = 2 (n + 1) is a power of two only for
+ * some n. Other lengths use Bluestein's algorithm, which writes the FFT as a
+ * convolution with a chirp, done in turn with FFTs of the power of two l >=
+ * 2 m - 1. Either way it takes O(n log n).
+ */
+#include <stddef.h>
+
+struct dst_complex {
+  double re, im;
+};
+
+struct dst {
+  size_t n;
+  /* Length of the odd extension, and of the FFTs (m itself if a power of 2) */
+  size_t m, l;
+  /* exp(-i pi k^2 / m), k < m, and the FFT of its conjugate, l long. NULL if
+   * the FFT is done directly */
+  struct dst_complex *chirp, *kernel;
+  /* exp(-2 i pi k / l), k < l / 2 */
+  struct dst_complex *twiddles;
+};
+
+/*
+ * Prepares the transform of length n (> 0). Returns 0 on success, 1 on error,
+ * reporting the error to stderr. On error, call dst_free anyway.
+ */
+int
+dst_init(struct dst *dst, size_t n);
+
+/*
+ * Transforms the n points x[0], x[stride], ... in place. work has room for
+ * dst->l points, and cannot be shared by concurrent calls.
+ */
+void
+dst_apply(struct dst const *dst, double *x, ptrdiff_t stride, struct
+    dst_complex *work);
+
+void
+dst_free(struct dst *dst);
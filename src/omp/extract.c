@@ -0,0 +1,164 @@
+/*
+ * Compilation: make
+ * Usage: ./extract --help
+ *
+ * Extracts frames from a container written by heat -o -c (see container.h),
+ * either as the itX.ppm files heat would otherwise have written or as a Y4M
+ * (YUV4MPEG2) video stream, which video tools read directly.
+ */
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "logging.h"
+#include "dry.h"
+#include "args_extract.h"
+#include "frame.h"
+#include "container.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Convert the n pixels of rgb into the planes of a 4:4:4 Y'CbCr frame (BT.601,
+ * studio range, the default of Y4M), each n bytes, one after the other.
+ */
+static void
+yuv(uint8_t *planes, uint8_t const *rgb, size_t n)
+{
+  uint8_t *y = planes, *cb = planes + n, *cr = planes + 2 * n;
+  for (size_t j = 0; j < n; j++) {
+    int r = rgb[3 * j], g = rgb[3 * j + 1], b = rgb[3 * j + 2];
+    /* Fixed point, offsets included so the shifts never see negatives */
+    y[j] = (uint8_t)((66 * r + 129 * g + 25 * b + 4224) >> 8);
+    cb[j] = (uint8_t)((-38 * r - 74 * g + 112 * b + 32896) >> 8);
+    cr[j] = (uint8_t)((112 * r - 94 * g - 18 * b + 32896) >> 8);
+  }
+}
+
+/*
+ * Write frames [first, first + n) of container to stdout as a Y4M video at fps
+ * frames per second. Returns 0 on success, 1 on error, reporting the error to
+ * stderr.
+ */
+static int
+write_y4m(struct container *container, void *frame, DRY(uint64_t, first, n),
+    unsigned fps)
+{
+  int ans = 1;
+  struct container_header const *header = container->header;
+  size_t points = (size_t)(header->w * header->h);
+  uint8_t *rgb = malloc(3 * points), *planes = malloc(3 * points);
+  if (!rgb || !planes) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    goto y4m_malloc;
+  }
+  if (printf("YUV4MPEG2 W%"PRIu64" H%"PRIu64" F%u:1 Ip A1:1 C444\n",
+        header->w, header->h, fps) < 0) {
+    LOG_ERROR("Could not write Y4M header: %s\n", strerror(errno));
+    goto y4m_malloc;
+  }
+  for (uint64_t k = first; k < first + n; k++) {
+    if (container_read(container, k, frame))
+      goto y4m_malloc;
+    frame_rgb(rgb, frame, header->format, points, container->index[k].mval);
+    yuv(planes, rgb, points);
+    if (fputs("FRAME\n", stdout) == EOF || fwrite(planes, 3, points, stdout)
+        != points) {
+      LOG_ERROR("Could not write frame %"PRIu64": %s\n", k, strerror(errno));
+      goto y4m_malloc;
+    }
+  }
+  if (fflush(stdout)) {
+    LOG_ERROR("Could not write Y4M: %s\n", strerror(errno));
+    goto y4m_malloc;
+  }
+  ans = 0;
+y4m_malloc:
+  free(rgb);
+  free(planes);
+  return ans;
+}
+
+/*
+ * Write frames [first, first + n) of container to itX.ppm, X being the
+ * iteration of each. Returns 0 on success, 1 on error, reporting the error to
+ * stderr.
+ */
+static int
+write_ppms(struct container *container, void *frame, DRY(uint64_t, first, n))
+{
+  struct container_header const *header = container->header;
+  char filename[256];
+  for (uint64_t k = first; k < first + n; k++) {
+    struct container_entry const *entry = container->index + k;
+    int rc = snprintf(filename, 256, "it%"PRIu64".ppm", entry->iter);
+    if (rc < 0 || rc >= 256) {
+      LOG_ERROR("Generating filename for iter %"PRIu64"\n", entry->iter);
+      return 1;
+    }
+    if (container_read(container, k, frame) || write_ppm(filename, frame,
+          header->format, (size_t)header->w, (size_t)header->h, entry->mval))
+      return 1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int ans = EXIT_FAILURE;
+  struct argp_arguments args;
+  memset(&args, 0, sizeof(args));
+  args.fps = 25;
+  struct argp argp = {
+    ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
+  };
+  if (argp_parse(&argp, argc, argv, ARGP_FLAGS, ARGP_INDEX, &args) ==
+      ARGP_KEY_ERROR) {
+    LOG_CRITICAL("While parsing parameters. Try --help.\n");
+    goto main_return;
+  }
+  struct container container;
+  if (container_open(&container, args.input[0]))
+    goto main_return;
+  struct container_header const *header = container.header;
+  if (header->format >= FORMATS || !header->h || header->w > SIZE_MAX / 8 /
+      header->h ||
+      header->frame_size != header->w * header->h *
+      FORMAT_BYTES[header->format]) {
+    LOG_CRITICAL("%s: Unknown frame format or size\n", args.input[0]);
+    goto main_container;
+  }
+  if (args.first > header->count) {
+    LOG_CRITICAL("%s: Only has %"PRIu64" frames\n", args.input[0],
+        header->count);
+    goto main_container;
+  }
+  uint64_t n = header->count - args.first;
+  if (args.frames && args.frames < n)
+    n = args.frames;
+  if (args.list) {
+    for (uint64_t k = args.first; k < args.first + n; k++)
+      printf("%"PRIu64" %"PRIu64" %g\n", k, container.index[k].iter,
+          container.index[k].mval);
+    ans = EXIT_SUCCESS;
+    goto main_container;
+  }
+  void *frame = malloc((size_t)header->frame_size);
+  if (!frame) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_container;
+  }
+  if (args.y4m ? write_y4m(&container, frame, args.first, n, args.fps) :
+      write_ppms(&container, frame, args.first, n))
+    goto main_frame;
+  ans = EXIT_SUCCESS;
+main_frame:
+  free(frame);
+main_container:
+  if (container_close(&container))
+    ans = EXIT_FAILURE;
+main_return:
+  return ans;
+}
@@ -0,0 +1,145 @@
+#pragma once
+/*
+ * Frames, as stored in the output buffer of heat -o and in the container (see
+ * container.h), and their conversion to heatmap colors. A frame is the w x h
+ * surface without row padding, in one of the formats below. Other than double,
+ * formats need the max temperature of the frame (mval) stored alongside it.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Magic number for the output files */
+#define OUT_MNUMBER "P6"
+
+/* How frames are stored in the output buffer and the container */
+enum format {
+  FORMAT_DOUBLE,
+  FORMAT_U16,
+  FORMAT_U8,
+  FORMAT_RGB,
+  FORMATS
+};
+
+static char const *const FORMAT_NAMES[FORMATS] = {
+  "double", "u16", "u8", "rgb"
+};
+
+/* Bytes per point of a frame */
+static size_t const FORMAT_BYTES[FORMATS] = {
+  sizeof(double), sizeof(uint16_t), sizeof(uint8_t), 3
+};
+
+/* Used for the heatmap (color gradient representing the temps) */
+struct RGB {
+  uint8_t r, g, b;
+  double val;
+};
+
+/* Colder to hotter */
+static struct RGB const HEATMAP[5] = {
+  { 0, 0, 255, 0.0 },     /* blue */
+  { 0, 255, 255, 0.25 },  /* cyan */
+  { 0, 255, 0, 0.5 },     /* green */
+  { 255, 255, 0, 0.75 },  /* yellow */
+  { 255, 0, 0, 1.0 }      /* red */
+};
+
+/* Write the heatmap color of p, a temperature over the max, to rgb */
+static inline void
+color(double p, uint8_t *rgb)
+{
+  struct RGB const *red = HEATMAP + 4;
+  rgb[0] = red->r;
+  rgb[1] = red->g;
+  rgb[2] = red->b;
+  for (uint8_t k = 0; k < 5; k++)
+    if (p < HEATMAP[k].val) {
+      struct RGB const *prev = HEATMAP + (k - 1 < 0 ? 0 : k - 1);
+      double vdiff = prev->val - HEATMAP[k].val;
+      double diff = vdiff ? (p - HEATMAP[k].val) / vdiff : 0.0;
+      rgb[0] = (uint8_t)((prev->r - HEATMAP[k].r) * diff + HEATMAP[k].r);
+      rgb[1] = (uint8_t)((prev->g - HEATMAP[k].g) * diff + HEATMAP[k].g);
+      rgb[2] = (uint8_t)((prev->b - HEATMAP[k].b) * diff + HEATMAP[k].b);
+      break;
+    }
+}
+
+/* Clamp p to [0, 1] (NaN, as in 0 / 0, to 0) */
+static inline double
+unit(double p)
+{
+  return p > 0.0 ? (p < 1.0 ? p : 1.0) : 0.0;
+}
+
+/* Returns point k of a frame stored as format over mval, its max */
+static inline double
+relative(void const *frame, enum format format, size_t k, double mval)
+{
+  switch (format) {
+    case FORMAT_U16:
+      return ((uint16_t const *)frame)[k] / (double)UINT16_MAX;
+    case FORMAT_U8:
+      return ((uint8_t const *)frame)[k] / (double)UINT8_MAX;
+    default:
+      return ((double const *)frame)[k] / mval;
+  }
+}
+
+/* Write the colors of the first n points of frame, stored as format, to rgb */
+static void
+frame_rgb(uint8_t *rgb, void const *frame, enum format format, size_t n,
+    double mval)
+{
+  if (format == FORMAT_RGB) {
+    memcpy(rgb, frame, 3 * n);
+    return;
+  }
+  for (size_t j = 0; j < n; j++)
+    color(relative(frame, format, j, mval), rgb + 3 * j);
+}
+
+/*
+ * Write the w x h frame, stored as format, to filename as a .ppm, scaling the
+ * temperatures to the heatmap by mval. Returns 0 on success, 1 on error,
+ * reporting the error to stderr.
+ */
+static int
+write_ppm(char const *filename, void const *frame, enum format format,
+    DRY(size_t, w, h), double mval)
+{
+  int ans = 1;
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    goto write_return;
+  }
+  uint8_t *row = malloc(3 * w);
+  if (!row) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    goto write_fopen;
+  }
+  // FIXME check rc
+  fprintf(f, OUT_MNUMBER" %zu %zu 255 ", w, h);
+  for (size_t i = 0; i < h; i++) {
+    frame_rgb(row, (uint8_t const *)frame + i * w * FORMAT_BYTES[format],
+        format, w, mval);
+    if (fwrite(row, 3, w, f) != w) {
+      LOG_ERROR("%s: Could not write row %zu: %s\n", filename, i,
+          strerror(errno));
+      goto write_row;
+    }
+  }
+  ans = 0;
+write_row:
+  free(row);
+write_fopen:
+  if (fclose(f)) {
+    LOG_ERROR("%s: Could not close file: %s\n", filename, strerror(errno));
+    ans = 1;
+  }
+write_return:
+  return ans;
+}
@@ -11,8 +11,21 @@
 #include "logging.h"
 #include "dry.h"
 #include "args.h"
+#include "arena.h"
+#include "libheat.h"
+#include "pyramid.h"
+#include "probe.h"
+#include "frame.h"
+#include "container.h"
+#include "ooc.h"
+#include "amr.h"
+#include "spectral.h"
+#include "stats.h"
+#include "stencil.h"
+#include "tune.h"
 #include <errno.h>
 #include <inttypes.h>
+#include <omp.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,44 +33,156 @@
 /* Magic number for the input file */
 #define IN_MNUMBER "P2"
 
-/* Magic number for the output files */
-#define OUT_MNUMBER "P6"
+/* Rows of buffer per thread needed by step_lean */
+#define LEAN_ROWS 3
 
-/* Copy the surface b into surface a, both w x h */
+/*
+ * Timesteps the default engine runs in a single parallel region at most, so
+ * the stats published in between (see stats.h) keep up with the run
+ */
+#define ADVANCE_STEPS 64
+
+/* Returns the format called name, or FORMATS if there is none */
+static enum format
+format_parse(char const *name)
+{
+  int f = 0;
+  while (f < FORMATS && strcmp(name, FORMAT_NAMES[f]))
+    f++;
+  return (enum format)f;
+}
+
+/*
+ * Copy the w x h surface b, with rows pitch doubles apart, into a, without
+ * the padding between the rows
+ */
 static inline void
-copy(double *a, double const *b, DRY(size_t, w, h))
+pack(double *a, double const *b, DRY(size_t, w, h, pitch))
 {
-  memcpy(a, b, w * h * sizeof(*a));
+  for (size_t i = 0; i < h; i++)
+    memcpy(a + i * w, b + i * pitch, w * sizeof(*a));
 }
 
 /*
- * Return the max temperature in the w x h surface. We need to do this for
- * every timestep to draw the temperatures correctly. Calculating a theoretical
- * maximum value for the timestep (O(1) instead of O(n)) is not acceptable as
- * the mapping ends up being wrong if it differs from the actual max value.
+ * Return the max temperature in the w x h surface, with rows pitch doubles
+ * apart. We need the max of every frame to draw the temperatures correctly.
+ * Calculating a theoretical maximum value for the timestep (O(1) instead of
+ * O(n)) is not acceptable as the mapping ends up being wrong if it differs
+ * from the actual max value.
  *
- * An alternative is to keep track of the max values while calculating the heat
- * on the plate, but that would require synchronization between the threads and
- * add considerable complexity to the code. A quick perf analysis revealed that
- * this function is not a bottleneck for images up to 1000x1000, so leave it
- * like this for now.
+ * Going through every frame again would cost as much as a timestep, so the
+ * max is kept track of while calculating the heat on the plate instead (an
+ * OpenMP max reduction, see main), and this is only used for the first frame.
+ */
+static double
+max(double const *surface, DRY(size_t, w, h, pitch))
+{
+  double ans = surface[0];
+  for (size_t i = 0; i < h; i++)
+    for (size_t j = 0; j < w; j++)
+      if (surface[i * pitch + j] > ans)
+        ans = surface[i * pitch + j];
+  return ans;
+}
+
+/*
+ * Return the max temperature on the edges of the w x h surface, with rows
+ * pitch doubles apart. The edges never change, so the max of every frame is
+ * the max of this and of the points calculated on each timestep.
  */
 static double
-max(double const *surface, DRY(size_t, w, h))
+edge_max(double const *surface, DRY(size_t, w, h, pitch))
 {
   double ans = surface[0];
-  for (size_t i = 1; i < w * h; i++)
-    if (surface[i] > ans)
-      ans = surface[i];
+  for (size_t j = 0; j < w; j++) {
+    if (surface[j] > ans)
+      ans = surface[j];
+    if (surface[(h - 1) * pitch + j] > ans)
+      ans = surface[(h - 1) * pitch + j];
+  }
+  for (size_t i = 0; i < h; i++) {
+    if (surface[i * pitch] > ans)
+      ans = surface[i * pitch];
+    if (surface[i * pitch + w - 1] > ans)
+      ans = surface[i * pitch + w - 1];
+  }
   return ans;
 }
 
+/* What trial needs to time a timestep */
+struct trial {
+  struct heat const *heat;
+  double edges;
+};
+
+/*
+ * A timestep for tune_search, into the next grid of the engine. Only a copy
+ * of the engine swaps, so the plate does not change and the trials can go on
+ * as long as needed.
+ */
+static void
+trial(struct tune const *tune, void *data)
+{
+  struct trial const *t = data;
+  struct heat heat = *t->heat;
+  heat_advance(&heat, 1, tune->tile, t->edges);
+}
+
+/*
+ * Same as a timestep of heat_advance (see libheat.h), but in place, without a
+ * second grid, for plates that only fit in memory once. The interior rows are
+ * split in a band per thread. Before anyone writes, each thread saves the rows
+ * just outside its band (the edges of its neighbours' bands, or of the plate)
+ * to its own buffers. Then it sweeps its band top to bottom, saving each row
+ * before overwriting it, so the current values of the row above and of the
+ * row itself are always at hand, and the row below has not been written yet.
+ * rows has room for LEAN_ROWS rows of pitch doubles per thread.
+ */
+static double
+step_lean(double *surface, double *rows, DRY(size_t, w, h, pitch),
+    DRY(double, alpha, edges))
+{
+  double next = edges;
+  if (h < 3)
+    return next;
+#pragma omp parallel reduction(max:next)
+  {
+    size_t t = (size_t)omp_get_thread_num();
+    size_t threads = (size_t)omp_get_num_threads();
+    size_t first = 1 + (h - 2) * t / threads;
+    size_t last = 1 + (h - 2) * (t + 1) / threads;
+    double *north = rows + t * LEAN_ROWS * pitch, *south = north + pitch,
+           *center = south + pitch;
+    if (first < last) {
+      memcpy(north, surface + (first - 1) * pitch, w * sizeof(*north));
+      memcpy(south, surface + last * pitch, w * sizeof(*south));
+    }
+#pragma omp barrier
+    for (size_t i = first; i < last; i++) {
+      double *row = surface + i * pitch;
+      double const *below = i + 1 < last ? row + pitch : south;
+      memcpy(center, row, w * sizeof(*row));
+      for (size_t j = 1; j < w - 1; j++) {
+        row[j] = center[j] + alpha * (center[j + 1] + center[j - 1] - 4 *
+            center[j] + below[j] + north[j]);
+        if (row[j] > next)
+          next = row[j];
+      }
+      /* This row is the one above the next */
+      double *swap = north;
+      north = center;
+      center = swap;
+    }
+  }
+  return next;
+}
+
 /*
- * Read a .pgm-like file with the initial state of the plate into a surface
- * (array of doubles), dynamically allocated to the size of the image and
- * returned on success. On error, nothing is allocated and NULL is returned.
- * The error is registered to stderr. The size of the image is read into w,h.
- * On error, this size may or may not be read into the vars.
+ * Open a .pgm-like file with the initial state of the plate and read its
+ * header, leaving the file at the first point, which init_read reads into a
+ * surface. Returns the file on success. On error, nothing is opened and NULL
+ * is returned. The error is registered to stderr. The size of the image is
+ * read into w,h. On error, this size may or may not be read into the vars.
  *
  * We use a .pgm so the user can create the initial plate state with image
  * editing software. The values of the PGM can actually be doubles, and the
@@ -72,10 +197,9 @@ max(double const *surface, DRY(size_t, w, h))
  * No comments allowed in the .pgm - GIMP places one in the header, remove it
  * manually before using this code.
  */
-static double *
-init(char const *filename, DRY(size_t *, w, h))
+static FILE *
+init_open(char const *filename, DRY(size_t *, w, h))
 {
-  double *ans = NULL;
   FILE *f = fopen(filename, "r");
   if (!f) {
     LOG_ERROR("Could not open %s: %s\n", filename, strerror(errno));
@@ -98,99 +222,158 @@ init(char const *filename, DRY(size_t *, w, h))
     LOG_ERROR("Image dimensions should be > 0 (got %zu, %zu)\n", *w, *h);
     goto init_fopen;
   }
-  size_t area = *w * *h;
-  if (area / *w != *h || (area * sizeof(*ans)) / area != sizeof(*ans)) {
+  /* Leave room for the row padding (see arena_pitch) */
+  size_t area = (*w + ARENA_ALIGN) * *h;
+  if (area / (*w + ARENA_ALIGN) != *h || (area * sizeof(double)) / area !=
+      sizeof(double)) {
     LOG_ERROR("Image dimensions (%zu, %zu) too large (overflows)\n", *w, *h);
     goto init_fopen;
   }
-  ans = malloc(*w * *h * sizeof(*ans));
-  if (!ans) {
-    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
-    goto init_fopen;
-  }
-  for (size_t i = 0; i < *w * *h; i++)
-    if (fscanf(f, "%lf ", ans + i) != 1) {
-      LOG_ERROR("%s: Reading point %zu: %s\n", filename, i, ferror(f) ?
-          strerror(errno) : "EOF");
-      goto init_malloc;
-    }
-  goto init_fopen;
-init_malloc:
-  free(ans);
-  ans = NULL;
+  return f;
 init_fopen:
   fclose(f);
 init_return:
-  return ans;
+  return NULL;
 }
 
-/* Used for the heatmap (color gradient representing the temps) */
-struct RGB {
-  uint8_t r, g, b;
-  double val;
-};
+/*
+ * Read the points of the w x h plate from f, opened by init_open, into
+ * surface, whose rows are pitch doubles apart. Returns 0 on success, 1 on
+ * error, reporting the error to stderr.
+ */
+static int
+init_read(FILE *f, char const *filename, double *surface, DRY(size_t, w, h,
+      pitch))
+{
+  for (size_t i = 0; i < h; i++)
+    for (size_t j = 0; j < w; j++)
+      if (fscanf(f, "%lf ", surface + i * pitch + j) != 1) {
+        LOG_ERROR("%s: Reading point %zu: %s\n", filename, i * w + j,
+            ferror(f) ? strerror(errno) : "EOF");
+        return 1;
+      }
+  return 0;
+}
+
+#define CAPTURE(point)\
+  do {\
+    _Pragma("omp parallel for")\
+    for (size_t i = 0; i < h; i++) {\
+      for (size_t j = 0; j < w; j++) {\
+        size_t k = i * w + j;\
+        double p = surface[i * pitch + j] / mval;\
+        point;\
+      }\
+    }\
+  } while (0)
+
+/*
+ * Store the w x h surface, with rows pitch doubles apart, into frame as
+ * format. mval is the max of the surface: u16 and u8 store each temperature
+ * over it scaled to the whole range of the type, rgb stores its heatmap color.
+ * double stores the temperatures as they are, without the row padding.
+ */
+static void
+capture(void *frame, enum format format, double const *surface, DRY(size_t,
+      w, h, pitch), double mval)
+{
+  switch (format) {
+    case FORMAT_U16:
+      CAPTURE(((uint16_t *)frame)[k] = (uint16_t)(unit(p) * UINT16_MAX +
+            0.5));
+      break;
+    case FORMAT_U8:
+      CAPTURE(((uint8_t *)frame)[k] = (uint8_t)(unit(p) * UINT8_MAX + 0.5));
+      break;
+    case FORMAT_RGB:
+      CAPTURE(color(p, (uint8_t *)frame + 3 * k));
+      break;
+    default:
+      pack(frame, surface, w, h, pitch);
+  }
+}
 
 /*
- * Flush n w x h surfaces to iter files named itX.pgm, for all X in [0+offset,
- * n+offset). Returns 0 on success, 1 on error, reporting the error to stderr.
+ * Flush n w x h frames stored as format, with maxes mvals, taken every stride
+ * iters, to iter files named itX.ppm, for all X in [0+offset, n+offset) *
+ * stride, plus the means of every level of pyramid to itX.lK.ppm (colored
+ * relative to the full frame, so levels can be compared, only for double
+ * frames). If container is not NULL, the frames (in slots, see
+ * container_slot) are appended to it instead. Returns 0 on success, 1 on
+ * error, reporting the error to stderr.
  */
 static int
-flush(double *surfaces, DRY(uint64_t, n, offset), DRY(size_t, w, h))
+flush(uint8_t const *frames, double const *mvals, enum format format,
+    DRY(uint64_t, n, offset, stride), DRY(size_t, w, h), struct pyramid
+    *pyramid, struct container *container)
 {
-  /* Colder */
-  struct RGB blue = { 0, 0, 255, 0.0};
-  struct RGB cyan = { 0, 255, 255, 0.25};
-  struct RGB green = { 0, 255, 0, 0.5};
-  struct RGB yellow = { 255, 255, 0, 0.75};
-  struct RGB red = { 255, 0, 0, 1.0};
-  /* Hotter */
-  struct RGB heatmap[5] = { blue, cyan, green, yellow, red };
+  if (container)
+    return container_append(container, frames, mvals, n, offset, stride);
   char filename[256];
   for (uint64_t i = 0; i < n; i++) {
-    int rc = snprintf(filename, 256, "it%"PRIu64".ppm", i + offset);
+    uint64_t iter = (i + offset) * stride;
+    int rc = snprintf(filename, 256, "it%"PRIu64".ppm", iter);
     if (rc < 0 || rc >= 256) {
-      LOG_ERROR("Generating filename for iter %"PRIu64"\n", i + offset);
+      LOG_ERROR("Generating filename for iter %"PRIu64"\n", iter);
       return 1;
     }
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-      LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    void const *frame = frames + (size_t)i * w * h * FORMAT_BYTES[format];
+    if (write_ppm(filename, frame, format, w, h, mvals[i]))
       return 1;
-    }
-    // FIXME check rc
-    fprintf(f, OUT_MNUMBER" %zu %zu 255 ", w, h);
-    double mval = max(surfaces + i * w * h, w, h);
-    for (size_t j = 0; j < w * h; j++) {
-      double p = surfaces[(size_t)i * w * h + j] / mval;
-      // TODO we can use our struct for this
-      uint8_t rgb[3] = { red.r, red.g, red.b };
-      for (uint8_t k = 0; k < 5; k++)
-        if (p < heatmap[k].val) {
-          struct RGB *prev = heatmap + (k - 1 < 0 ? 0 : k - 1);
-          double vdiff = prev->val - heatmap[k].val;
-          double diff = vdiff ? (p - heatmap[k].val) / vdiff : 0.0;
-          rgb[0] = (uint8_t)((prev->r - heatmap[k].r) * diff + heatmap[k].r);
-          rgb[1] = (uint8_t)((prev->g - heatmap[k].g) * diff + heatmap[k].g);
-          rgb[2] = (uint8_t)((prev->b - heatmap[k].b) * diff + heatmap[k].b);
-          break;
-        }
-      if (fwrite(rgb, 1, 3, f) != 3) {
-        LOG_ERROR("%s: Could not write pixel %zu: %s\n", filename, j,
-            strerror(errno));
-        if (fclose(f))
-          LOG_ERROR("%s: Could not close file: %s\n", filename,
-              strerror(errno));
+    if (!pyramid->levels)
+      continue;
+    pyramid_build(pyramid, frame, w);
+    for (unsigned k = 1; k <= pyramid->levels; k++) {
+      rc = snprintf(filename, 256, "it%"PRIu64".l%u.ppm", iter, k);
+      if (rc < 0 || rc >= 256) {
+        LOG_ERROR("Generating filename for iter %"PRIu64" level %u\n", iter,
+            k);
         return 1;
       }
-    }
-    if (fclose(f)) {
-      LOG_ERROR("%s: Could not close file: %s\n", filename, strerror(errno));
-      return 1;
+      if (write_ppm(filename, pyramid_plane(pyramid, k, PYRAMID_MEAN),
+            FORMAT_DOUBLE, pyramid_dim(w, k), pyramid_dim(h, k), mvals[i]))
+        return 1;
     }
   }
   return 0;
 }
 
+/*
+ * Run every iteration with the out-of-core engine (see ooc.h), reading the w x
+ * h plate from in, opened by init_open, straight into the file args->ooc,
+ * which is left with the final state, publishing to stats after every pass.
+ * Returns 0 on success, 1 on error, reporting the error to stderr.
+ */
+static int
+out_of_core(struct argp_arguments const *args, FILE *in, DRY(size_t, w, h),
+    double alpha, struct stats *stats)
+{
+  int ans = 1;
+  struct ooc ooc;
+  if (ooc_create(&ooc, args->ooc, w, h, args->skew))
+    goto ooc_return;
+  if (init_read(in, args->input[0], ooc.surface, w, h, w))
+    goto ooc_create;
+  struct stats_record record = {
+    0, (uint64_t)(w - 2) * (h - 2), 0, 0, 0.0, 0.0, 0.0, -1.0
+  };
+  for (uint64_t iters = 0; iters < args->iters; iters += args->skew) {
+    uint64_t left = args->iters - iters;
+    if (ooc_advance(&ooc, left < args->skew ? (unsigned)left : args->skew,
+          alpha))
+      goto ooc_create;
+    record.iters = left < args->skew ? args->iters : iters + args->skew;
+    record.time = (double)record.iters * args->timestep;
+    stats_update(stats, &record);
+  }
+  ans = 0;
+ooc_create:
+  if (ooc_close(&ooc))
+    ans = 1;
+ooc_return:
+  return ans;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -203,6 +386,12 @@ main(int argc, char **argv)
   args.spacestep = -1.0;
   args.timestep = -1.0;
   args.bsize = 536870912; /* 512MB */
+  args.probe_stride = 1;
+  args.frame_stride = 1;
+  args.skew = 8;
+  args.refine = 0.05;
+  args.regrid = 4;
+  args.safety = 0.9;
   struct argp argp = {
     ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
   };
@@ -211,27 +400,139 @@ main(int argc, char **argv)
     LOG_CRITICAL("While parsing parameters. Try --help.\n");
     goto main_return;
   }
-  size_t w = 0, h = 0;
-  /* Checks for w * h * sizeof(*surface) <= SIZE_MAX && w > 0 && h > 0 */
-  double *surface = init(args.input[0], &w, &h);
-  if (!surface) {
-    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+  enum format format = args.format ? format_parse(args.format) :
+    FORMAT_DOUBLE;
+  if (format == FORMATS) {
+    LOG_CRITICAL("Unknown frame format %s. Try --help.\n", args.format);
+    goto main_return;
+  }
+  if (args.output && args.levels && format != FORMAT_DOUBLE) {
+    LOG_CRITICAL("Levels are computed from double frames, use -q double.\n");
+    goto main_return;
+  }
+  if (args.output && args.levels && args.container) {
+    LOG_CRITICAL("Levels are not stored in the container.\n");
+    goto main_return;
+  }
+  enum stencil stencil = args.stencil ? stencil_parse(args.stencil) :
+    STENCIL_5;
+  if (stencil == STENCILS) {
+    LOG_CRITICAL("Unknown stencil %s. Try --help.\n", args.stencil);
+    goto main_return;
+  }
+  /* The other engines only have the 5-point stencil */
+  if (stencil != STENCIL_5 && (args.lean || args.ooc || args.amr)) {
+    LOG_CRITICAL("The %s-point stencil does not support -m, -O or -a.\n",
+        STENCIL_NAMES[stencil]);
+    goto main_return;
+  }
+  if (args.tune && (args.lean || args.ooc || args.amr)) {
+    LOG_CRITICAL("Only the default engine is tuned, -t does not support -m, "
+        "-O or -a.\n");
+    goto main_return;
+  }
+  if (args.amr && (args.lean || args.ooc)) {
+    LOG_CRITICAL("AMR does not support -m or -O.\n");
+    goto main_return;
+  }
+  if (args.spectral && (args.lean || args.ooc || args.amr || args.tune ||
+        STENCIL_HALO[stencil] > 1)) {
+    LOG_CRITICAL("The spectral engine only has the 5 and 9-point stencils, "
+        "and does not support -m, -O, -a or -t.\n");
+    goto main_return;
+  }
+  if ((args.frame_time > 0 || args.probe_time > 0) && !(args.until > 0)) {
+    LOG_CRITICAL("-F and -T are only applicable with -u.\n");
     goto main_return;
   }
-  size_t surface_size = w * h * sizeof(*surface);
-  double *osurface = malloc(surface_size);
-  if (!osurface) {
+  size_t w = 0, h = 0;
+  /* Checks for (w + padding) * h * sizeof(*surface) <= SIZE_MAX && w > 0 &&
+   * h > 0 */
+  FILE *in = init_open(args.input[0], &w, &h);
+  if (!in) {
     LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
-    goto main_surface;
+    goto main_return;
   }
-  copy(osurface, surface, w, h);
+  /* The grids have padded rows, frames in the buffer are packed */
+  size_t pitch = arena_pitch(w);
+  size_t surface_size = pitch * h * sizeof(double);
+  size_t frame_size = w * h * FORMAT_BYTES[format];
+  /* Frames are block aligned in the buffer if written to the container */
+  size_t slot_size = args.container ? container_slot(frame_size) : frame_size;
   // FIXME how is this defined for w != h? Seems to work like this for w > h...
   if (args.spacestep < 0)
     args.spacestep = 1 / (double)w;
-  if (args.timestep < 0)
-    args.timestep = (args.spacestep * args.spacestep) / (4 * args.diffusivity);
+  double limit = STENCIL_LIMIT[stencil] * (args.spacestep *
+      args.spacestep) / args.diffusivity;
+  /* The spectral engine has no timesteps to be unstable */
+  if (args.timestep >= 0 && !args.spectral && !stencil_stable(stencil,
+        args.diffusivity * (args.timestep / (args.spacestep *
+            args.spacestep)))) {
+    if (args.until > 0) {
+      LOG_CRITICAL("Timestep %g is over the largest stable one, %g, with the "
+          "%s-point stencil.\n", args.timestep, limit,
+          STENCIL_NAMES[stencil]);
+      goto main_in;
+    }
+    LOG_WARNING("Timestep %g is over the largest stable one, %g, with the "
+        "%s-point stencil: the plate will blow up.\n", args.timestep, limit,
+        STENCIL_NAMES[stencil]);
+  }
+  if (args.until > 0) {
+    /*
+     * Equal timesteps ending on until, and on the frame and probe times. AMR
+     * samples whole coarse timesteps, so those are split instead
+     */
+    uint64_t chunk = args.amr ? AMR_SUBCYCLE : 1;
+    double every[] = {args.frame_time, args.probe_time};
+    uint64_t strides[2];
+    args.iters = chunk * stencil_steps(args.until, (double)chunk *
+        (args.timestep >= 0 ? args.timestep : args.safety * limit), every,
+        strides, 2);
+    args.timestep = args.until / (double)args.iters;
+    if (every[0] > 0)
+      args.frame_stride = chunk * strides[0];
+    if (every[1] > 0)
+      args.probe_stride = chunk * strides[1];
+    LOG_INFO("%"PRIu64" timesteps of %g s\n", args.iters, args.timestep);
+    for (size_t k = 0; k < 2; k++) {
+      double off = (double)(chunk * strides[k]) * args.timestep - every[k];
+      if (every[k] > 0 && (off > every[k] * STENCIL_SLACK || -off > every[k] *
+            STENCIL_SLACK))
+        LOG_WARNING("%g s does not divide %g s, sampling every %g s "
+            "instead.\n", every[k], args.until, (double)(chunk * strides[k])
+            * args.timestep);
+    }
+  } else if (args.timestep < 0) {
+    args.timestep = limit;
+  }
+  /* Iterations sampled, the plate at until is too */
+  uint64_t last = args.until > 0 ? args.iters + 1 : args.iters;
+  /* AMR only has the plate at full resolution every coarse timestep */
+  if (args.amr && ((args.nprobes && args.probe_stride % AMR_SUBCYCLE) ||
+        (args.output && args.frame_stride % AMR_SUBCYCLE))) {
+    LOG_CRITICAL("With AMR, strides should be multiples of %d.\n",
+        AMR_SUBCYCLE);
+    goto main_in;
+  }
   double alpha = args.diffusivity * (args.timestep / (args.spacestep *
         args.spacestep));
+  /* Publishing does nothing without --stats */
+  struct stats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (args.stats && stats_create(&stats, args.stats, 1, args.iters,
+        args.timestep))
+    goto main_stats;
+  if (args.ooc) {
+    if (args.output || args.nprobes || args.lean) {
+      LOG_CRITICAL("The out-of-core engine only writes the final plate, it "
+          "does not support -o, -P or -m.\n");
+      goto main_stats;
+    }
+    if (!out_of_core(&args, in, w, h, alpha, &stats))
+      ans = EXIT_SUCCESS;
+    goto main_stats;
+  }
   /*
    * Create a buffer where we will store the per-iter surfaces so we only
    * print the pgms once the buffer is filled (hopefully after the main loop
@@ -239,65 +540,225 @@ main(int argc, char **argv)
    */
   // TODO test this buffer thing more extensively, also do a perf analysis on
   // it to see if it really avoids our app being IO-bound
-  double *wsurfaces = NULL;
   uint64_t wsurfaces_n = 0;
   if (args.output) {
-    wsurfaces_n = args.bsize / surface_size;
+    wsurfaces_n = args.bsize / slot_size;
     if (!wsurfaces_n) {
       LOG_CRITICAL("Buffer size is too small to fit a single surface.\n");
-      goto main_osurface;
-    } else {
-      // TODO check for overflow?
-      wsurfaces = malloc((size_t)(wsurfaces_n) * surface_size);
-      if (!wsurfaces) {
-        LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
-        goto main_osurface;
-      }
+      goto main_stats;
     }
-    if (wsurfaces_n < args.iters)
+    if (wsurfaces_n < (last + args.frame_stride - 1) /
+        args.frame_stride)
       LOG_WARNING("Buffer size is too small to fit all iterations.\n");
   }
+  /*
+   * With --lean there is only one grid, and osurface has the rows step_lean
+   * needs instead. With AMR and the spectral engine, the grids are their own,
+   * and surface is where the plates sampled are written
+   */
+  size_t osurface_size = args.amr || args.spectral ? 0 : args.lean ? LEAN_ROWS *
+    (size_t)omp_get_max_threads() * pitch * sizeof(double) : surface_size;
+  /* Both grids and the buffer come from the same (huge page) mapping */
+  struct arena arena;
+  // TODO check for overflow?
+  if (arena_init(&arena, arena_reserve(surface_size) +
+        arena_reserve(osurface_size) + (wsurfaces_n ?
+          arena_reserve((size_t)wsurfaces_n * slot_size) +
+          arena_reserve((size_t)wsurfaces_n * sizeof(double)) : 0))) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_stats;
+  }
+  double *surface = arena_alloc(&arena, surface_size);
+  double *osurface = arena_alloc(&arena, osurface_size);
+  uint8_t *wsurfaces = !wsurfaces_n ? NULL : args.container ?
+    arena_alloc_page(&arena, (size_t)wsurfaces_n * slot_size) :
+    arena_alloc(&arena, (size_t)wsurfaces_n * slot_size);
+  /* The max of each buffered frame */
+  double *mvals = wsurfaces_n ? arena_alloc(&arena, (size_t)wsurfaces_n *
+      sizeof(double)) : NULL;
+  if (!surface || !osurface || (wsurfaces_n && (!wsurfaces || !mvals))) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_arena;
+  }
+  if (init_read(in, args.input[0], surface, w, h, pitch))
+    goto main_arena;
+  fclose(in);
+  in = NULL;
+  /*
+   * The default engine swaps surface and osurface every timestep, surface
+   * always being the plate as of the last one. It runs as tuned for this
+   * machine, if it was
+   */
+  struct heat heat;
+  heat_init(&heat, stencil, surface, osurface, w, h, pitch, alpha);
+  struct tune tune;
+  tune_default(&tune);
+  if (!args.lean && !args.amr && !args.spectral) {
+    heat_mirror(&heat);
+    if (args.tune) {
+      struct trial t = {&heat, edge_max(surface, w, h, pitch)};
+      /* Not being able to save it does not stop this run */
+      tune_search(&tune, STENCIL_NAMES[stencil], w, h, trial, &t);
+    } else {
+      tune_load(&tune, STENCIL_NAMES[stencil], w, h);
+    }
+    tune_apply(&tune);
+  }
+  struct amr amr;
+  if (args.amr && amr_init(&amr, surface, w, h, pitch, args.amr,
+        args.refine))
+    goto main_amr;
+  struct spectral spectral;
+  if (args.spectral && spectral_init(&spectral, stencil, surface, w, h,
+        pitch))
+    goto main_spectral;
+  struct pyramid pyramid;
+  if (pyramid_init(&pyramid, w, h, args.output ? args.levels : 0)) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_spectral;
+  }
+  struct probe *probes = calloc(args.nprobes, sizeof(*probes));
+  if (args.nprobes && !probes) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_pyramid;
+  }
+  for (size_t i = 0; i < args.nprobes; i++)
+    if (probe_init(probes + i, args.probes[i], w, h, pitch, (unsigned)i))
+      goto main_probes;
+  /* Room for every frame of the run */
+  struct container container, *out = NULL;
+  if (args.output && args.container) {
+    if (container_create(&container, args.container, format, w, h,
+          frame_size, (last + args.frame_stride - 1) /
+          args.frame_stride, args.direct))
+      goto main_probes;
+    out = &container;
+  }
   uint64_t wsurfaces_i = 0;
   uint64_t flushes = 0;
-  for (uint64_t iters = 0; iters < args.iters; iters++) {
-    if (args.output) {
+  /*
+   * Published every iteration (every run of heat_advance with the default
+   * engine), see stats.h
+   */
+  struct stats_record record = {
+    0, (uint64_t)(w - 2) * (h - 2), 0, wsurfaces_n, 0.0, 0.0, 0.0, -1.0
+  };
+  /* The max of surface, the next one is reduced along with the timestep */
+  double mval = max(surface, w, h, pitch);
+  double edges = edge_max(surface, w, h, pitch);
+  /*
+   * With AMR, iterations go a coarse timestep at a time. The spectral engine
+   * goes straight to the next iteration sampled, and the default engine runs
+   * up to it without leaving its parallel region (see heat_advance)
+   */
+  bool advance = !args.lean && !args.amr && !args.spectral;
+  uint64_t steps = 1, coarse = 0;
+  for (uint64_t iters = 0; iters < last; iters += steps) {
+    record.iters = iters;
+    record.time = (double)iters * args.timestep;
+    record.buffered = wsurfaces_i;
+    /* Only the default engine keeps the plate before the last timestep */
+    if (stats_asked(&stats) && advance)
+      record.residual = heat_residual(&heat, 1, h - 1);
+    stats_update(&stats, &record);
+    if (args.spectral || advance) {
+      steps = (args.spectral ? last : args.iters) - iters;
+      if (args.nprobes && args.probe_stride - iters % args.probe_stride <
+          steps)
+        steps = args.probe_stride - iters % args.probe_stride;
+      if (args.output && args.frame_stride - iters % args.frame_stride <
+          steps)
+        steps = args.frame_stride - iters % args.frame_stride;
+      if (advance && steps > ADVANCE_STEPS)
+        steps = ADVANCE_STEPS;
+    }
+    if (args.spectral && iters) {
+      spectral_at(&spectral, surface, pitch, (double)iters, alpha);
+      mval = max(surface, w, h, pitch);
+    }
+    if (args.amr) {
+      steps = args.iters - iters < AMR_SUBCYCLE ? args.iters - iters :
+        AMR_SUBCYCLE;
+      if ((args.nprobes && iters % args.probe_stride == 0) || (args.output &&
+            iters % args.frame_stride == 0)) {
+        amr_compose(&amr, surface, pitch);
+        mval = max(surface, w, h, pitch);
+      }
+    }
+    if (iters % args.probe_stride == 0)
+      for (size_t i = 0; i < args.nprobes; i++)
+        if (probe_sample(probes + i, surface, iters))
+          goto main_container;
+    if (args.output && iters % args.frame_stride == 0) {
       // TODO check for overflow?
-      copy(wsurfaces + (size_t)wsurfaces_i * w * h, surface, w, h);
+      capture(wsurfaces + (size_t)wsurfaces_i * slot_size, format, surface,
+          w, h, pitch, mval);
+      mvals[wsurfaces_i] = mval;
       if (wsurfaces_i >= wsurfaces_n - 1) {
         LOG_WARNING("Buffer had to be flushed to disk.\n");
-        if (flush(wsurfaces, wsurfaces_n, flushes * wsurfaces_n, w, h))
-          goto main_wsurface;
+        double io = omp_get_wtime();
+        if (flush(wsurfaces, mvals, format, wsurfaces_n, flushes *
+              wsurfaces_n, args.frame_stride, w, h, &pyramid, out))
+          goto main_container;
+        record.io += omp_get_wtime() - io;
         wsurfaces_i = 0;
         flushes++;
       } else {
         wsurfaces_i++;
       }
     }
-#pragma omp parallel for collapse(2)
-    for (size_t i = 1; i < h - 1; i++) {
-      for (size_t j = 1; j < w - 1; j++) {
-        size_t center = i * w + j;
-        size_t W = center - 1,
-               E = center + 1,
-               N = center - w,
-               S = center + w;
-        surface[center] = osurface[center] + alpha * (osurface[E] + osurface[W]
-            - 4 * osurface[center] + osurface[S] + osurface[N]);
-      }
+    if (iters == args.iters)
+      break;
+    /* Nothing to advance, see above */
+    if (args.spectral)
+      continue;
+    if (args.amr) {
+      amr_advance(&amr, (unsigned)steps, alpha);
+      if (++coarse % args.regrid == 0 && amr_regrid(&amr))
+        goto main_container;
+    } else if (args.lean) {
+      mval = step_lean(surface, osurface, w, h, pitch, alpha, edges);
+    } else {
+      mval = heat_advance(&heat, steps, tune.tile, edges);
+      surface = heat.plate;
     }
-    copy(osurface, surface, w, h);
   }
-  if (wsurfaces_i)
-    if (flush(wsurfaces, wsurfaces_i, flushes * wsurfaces_n, w, h))
-      goto main_wsurface;
+  if (wsurfaces_i) {
+    double io = omp_get_wtime();
+    if (flush(wsurfaces, mvals, format, wsurfaces_i, flushes * wsurfaces_n,
+          args.frame_stride, w, h, &pyramid, out))
+      goto main_container;
+    record.io += omp_get_wtime() - io;
+  }
+  record.iters = args.iters;
+  record.time = (double)args.iters * args.timestep;
+  record.buffered = 0;
+  stats_update(&stats, &record);
   ans = EXIT_SUCCESS;
-main_wsurface:
-  if (wsurfaces)
-    free(wsurfaces);
-main_osurface:
-  free(osurface);
-main_surface:
-  free(surface);
+main_container:
+  if (out && container_close(out))
+    ans = EXIT_FAILURE;
+main_probes:
+  for (size_t i = 0; i < args.nprobes; i++)
+    if (probe_free(probes + i))
+      ans = EXIT_FAILURE;
+  free(probes);
+main_pyramid:
+  pyramid_free(&pyramid);
+main_spectral:
+  if (args.spectral)
+    spectral_free(&spectral);
+main_amr:
+  if (args.amr)
+    amr_free(&amr);
+main_arena:
+  arena_free(&arena);
+main_stats:
+  stats_close(&stats);
+main_in:
+  if (in)
+    fclose(in);
 main_return:
+  free(args.probes);
   return ans;
 }
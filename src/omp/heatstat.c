@@ -0,0 +1,168 @@
+/*
+ * Compilation: make
+ * Usage: ./heatstat --help
+ *
+ * Shows the live metrics a run of heat (or seq or par in mpi/) publishes with
+ * --stats (see stats.h), so a slow or stalled run can be told apart from one
+ * that is just long without stopping it. Rates are measured between two
+ * samples -d seconds apart.
+ */
+/* for logging.h */
+#define _POSIX_C_SOURCE 200112L
+#include "logging.h"
+#include "args_heatstat.h"
+#include "stats.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The record of a rank as of a sample */
+struct sample {
+  struct stats_record record;
+  pid_t pid;
+  /* Whether the rank published anything yet */
+  bool ok;
+};
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Samples every rank of stats into samples */
+static void
+sample(struct stats const *stats, struct sample *samples)
+{
+  for (uint32_t r = 0; r < stats->header->ranks; r++)
+    samples[r].ok = !stats_read(stats, r, &samples[r].record,
+        &samples[r].pid);
+}
+
+/* What a rank is doing, from two samples of it */
+static char const *
+state(struct stats const *stats, struct sample const *before, struct sample
+    const *after)
+{
+  if (stats_done(stats))
+    return "done";
+  if (!after->ok)
+    return "starting";
+  if (kill(after->pid, 0) && errno == ESRCH)
+    return "dead";
+  if (before->ok && before->record.iters == after->record.iters)
+    return "stalled";
+  return "running";
+}
+
+/*
+ * Prints the progress of the run, and a line per rank, from samples before
+ * and after taken seconds apart
+ */
+static void
+print(struct stats const *stats, struct sample const *before, struct sample
+    const *after, double seconds)
+{
+  struct stats_header const *header = stats->header;
+  uint64_t iters = UINT64_MAX;
+  for (uint32_t r = 0; r < header->ranks; r++)
+    if (after[r].ok && after[r].record.iters < iters)
+      iters = after[r].record.iters;
+  if (iters == UINT64_MAX)
+    iters = 0;
+  printf("%"PRIu64" of %"PRIu64" iterations (%.1f%%), %g of %g s simulated\n",
+      iters, header->iters, header->iters ? 100.0 * (double)iters /
+      (double)header->iters : 100.0, (double)iters * header->timestep,
+      (double)header->iters * header->timestep);
+  printf("rank pid iters Mcells/s residual buffer io halo state\n");
+  for (uint32_t r = 0; r < header->ranks; r++) {
+    struct stats_record const *a = &after[r].record, *b = &before[r].record;
+    if (!after[r].ok) {
+      printf("%"PRIu32" - - - - - - - %s\n", r, state(stats, before + r,
+            after + r));
+      continue;
+    }
+    double mcells = before[r].ok ? (double)(a->iters - b->iters) *
+      (double)a->cells / seconds / 1e6 : 0.0;
+    printf("%"PRIu32" %ld %"PRIu64" %.1f ", r, (long)after[r].pid, a->iters,
+        mcells);
+    if (a->residual < 0)
+      printf("- ");
+    else
+      printf("%g ", a->residual);
+    if (a->buffer)
+      printf("%"PRIu64"/%"PRIu64" ", a->buffered, a->buffer);
+    else
+      printf("- ");
+    printf("%.3f %.3f %s\n", a->io, a->halo, state(stats, before + r, after +
+          r));
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  int ans = EXIT_FAILURE;
+  struct argp_arguments args;
+  memset(&args, 0, sizeof(args));
+  args.delay = 1.0;
+  struct argp argp = {
+    ARGP_OPT, argp_parse_options, ARGP_DOCA, ARGP_DOC, 0, 0, 0
+  };
+  if (argp_parse(&argp, argc, argv, ARGP_FLAGS, ARGP_INDEX, &args) ==
+      ARGP_KEY_ERROR) {
+    LOG_CRITICAL("While parsing parameters. Try --help.\n");
+    goto main_return;
+  }
+  struct stats stats;
+  if (stats_attach(&stats, args.input[0], UINT32_MAX))
+    goto main_return;
+  if (args.residual && stats_ask(&stats))
+    LOG_WARNING("%s is read only, residuals are not shown.\n",
+        args.input[0]);
+  uint32_t ranks = stats.header->ranks;
+  struct sample *before = calloc(ranks, sizeof(*before));
+  struct sample *after = calloc(ranks, sizeof(*after));
+  if (!before || !after) {
+    LOG_CRITICAL("%d: %s\n", __LINE__, strerror(errno));
+    goto main_samples;
+  }
+  struct timespec delay = {
+    (time_t)args.delay, (long)((args.delay - (double)(time_t)args.delay) *
+        1e9)
+  };
+  sample(&stats, before);
+  double mark = now();
+  for (;;) {
+    nanosleep(&delay, NULL);
+    sample(&stats, after);
+    double at = now();
+    print(&stats, before, after, at - mark);
+    if (!args.watch || stats_done(&stats))
+      break;
+    printf("\n");
+    if (fflush(stdout)) {
+      LOG_CRITICAL("Could not write: %s\n", strerror(errno));
+      goto main_samples;
+    }
+    struct sample *swap = before;
+    before = after;
+    after = swap;
+    mark = at;
+    if (args.residual)
+      stats_ask(&stats);
+  }
+  ans = EXIT_SUCCESS;
+main_samples:
+  free(before);
+  free(after);
+  stats_close(&stats);
+main_return:
+  return ans;
+}
@@ -0,0 +1,183 @@
+/* for sync_file_range and MADV_DONTNEED */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include "ooc.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Bytes streamed at a time */
+#define OOC_BAND ((size_t)64 << 20)
+
+/* Row i of level l, in the ring of 3 rows of that level */
+#define RING(ooc, l, i) ((ooc)->rings + ((size_t)(l) * 3 + (i) % 3) * (ooc)->w)
+
+int
+ooc_create(struct ooc *ooc, char const *filename, DRY(size_t, w, h),
+    unsigned levels)
+{
+  memset(ooc, 0, sizeof(*ooc));
+  ooc->w = w;
+  ooc->h = h;
+  ooc->size = w * h * sizeof(double);
+  ooc->levels = levels ? levels : 1;
+  ooc->band = OOC_BAND / (w * sizeof(double)) ? OOC_BAND / (w *
+      sizeof(double)) : 1;
+  ooc->rings = malloc(ooc->levels * 3 * w * sizeof(double));
+  if (!ooc->rings) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    goto create_return;
+  }
+  ooc->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (ooc->fd < 0) {
+    LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    goto create_rings;
+  }
+  /* Running out of disk midway would be a SIGBUS, find out now */
+  int rc = posix_fallocate(ooc->fd, 0, (off_t)ooc->size);
+  if (rc == EINVAL || rc == EOPNOTSUPP) {
+    LOG_INFO("%s: Could not preallocate: %s\n", filename, strerror(rc));
+    rc = ftruncate(ooc->fd, (off_t)ooc->size) ? errno : 0;
+  }
+  if (rc) {
+    LOG_ERROR("%s: Could not allocate %zu bytes: %s\n", filename, ooc->size,
+        strerror(rc));
+    goto create_open;
+  }
+  ooc->surface = mmap(NULL, ooc->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      ooc->fd, 0);
+  if (ooc->surface == MAP_FAILED) {
+    LOG_ERROR("%s: Could not map: %s\n", filename, strerror(errno));
+    goto create_open;
+  }
+  /* Filled and then read top to bottom */
+  if (madvise(ooc->surface, ooc->size, MADV_SEQUENTIAL))
+    LOG_INFO("%s: madvise: %s\n", filename, strerror(errno));
+  return 0;
+create_open:
+  close(ooc->fd);
+create_rings:
+  free(ooc->rings);
+create_return:
+  memset(ooc, 0, sizeof(*ooc));
+  ooc->fd = -1;
+  return 1;
+}
+
+/*
+ * Gives advice on rows [first, first + rows) of the plate, clipped to it. If
+ * inside, only on the pages entirely within those rows, otherwise on every
+ * page they touch.
+ */
+static void
+ooc_advise(struct ooc *ooc, size_t first, size_t rows, int advice, bool inside)
+{
+  if (first >= ooc->h)
+    return;
+  if (rows > ooc->h - first)
+    rows = ooc->h - first;
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)(ooc->surface + first * ooc->w);
+  uintptr_t end = (uintptr_t)(ooc->surface + (first + rows) * ooc->w);
+  start = inside ? (start + page - 1) / page * page : start / page * page;
+  end = inside ? end / page * page : (end + page - 1) / page * page;
+  if (start < end)
+    madvise((void *)start, end - start, advice);
+}
+
+/*
+ * Streaming, when the pass reaches row r: reads the next band ahead, starts
+ * writing back the last band the pass finished (the last level writes row
+ * r - steps) and drops the one before it from the mapping. Dirty pages stay
+ * in the page cache, so nothing is lost, but they do not pile up in the
+ * process.
+ */
+static void
+ooc_stream(struct ooc *ooc, size_t r, unsigned steps)
+{
+  size_t band = ooc->band;
+  ooc_advise(ooc, r + band, band, MADV_WILLNEED, false);
+  if (r < steps + band)
+    return;
+  size_t done = (r - steps) / band * band;
+  sync_file_range(ooc->fd, (off_t)((done - band) * ooc->w * sizeof(double)),
+      (off_t)(band * ooc->w * sizeof(double)), SYNC_FILE_RANGE_WRITE);
+  if (done >= 2 * band)
+    ooc_advise(ooc, done - 2 * band, band, MADV_DONTNEED, true);
+}
+
+int
+ooc_advance(struct ooc *ooc, unsigned steps, double alpha)
+{
+  size_t w = ooc->w, h = ooc->h;
+  double *plate = ooc->surface;
+  if (steps > ooc->levels) {
+    LOG_ERROR("Out of core: %u steps per pass, at most %u\n", steps,
+        ooc->levels);
+    return 1;
+  }
+  if (h < 3)
+    return 0;
+  ooc_advise(ooc, 0, ooc->band, MADV_WILLNEED, false);
+#pragma omp parallel
+  for (size_t r = 0; r < h + steps; r++) {
+#pragma omp single
+    {
+      if (r % ooc->band == 0)
+        ooc_stream(ooc, r, steps);
+      /* Level 0 is the plate as the last pass left it */
+      if (r < h)
+        memcpy(RING(ooc, 0, r), plate + r * w, w * sizeof(*plate));
+    }
+    for (unsigned l = 1; l <= steps && l <= r; l++) {
+      size_t i = r - l;
+      if (i >= h)
+        continue;
+      double *out = l == steps ? plate + i * w : RING(ooc, l, i);
+      /* The top and bottom rows never change */
+      if (i == 0 || i == h - 1) {
+#pragma omp single
+        if (l < steps)
+          memcpy(out, plate + i * w, w * sizeof(*out));
+        continue;
+      }
+      double const *N = RING(ooc, l - 1, i - 1), *C = RING(ooc, l - 1, i),
+            *S = RING(ooc, l - 1, i + 1);
+#pragma omp for
+      for (size_t j = 1; j < w - 1; j++)
+        out[j] = C[j] + alpha * (C[j + 1] + C[j - 1] - 4 * C[j] + S[j] +
+            N[j]);
+#pragma omp single
+      {
+        out[0] = C[0];
+        out[w - 1] = C[w - 1];
+      }
+    }
+  }
+  return 0;
+}
+
+int
+ooc_close(struct ooc *ooc)
+{
+  int ans = 0;
+  if (msync(ooc->surface, ooc->size, MS_SYNC)) {
+    LOG_ERROR("Out of core: Could not write back: %s\n", strerror(errno));
+    ans = 1;
+  }
+  munmap(ooc->surface, ooc->size);
+  if (close(ooc->fd)) {
+    LOG_ERROR("Out of core: Could not close: %s\n", strerror(errno));
+    ans = 1;
+  }
+  free(ooc->rings);
+  memset(ooc, 0, sizeof(*ooc));
+  ooc->fd = -1;
+  return ans;
+}
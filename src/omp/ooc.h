@@ -0,0 +1,54 @@
+#pragma once
+/*
+ * Out-of-core engine, for plates that do not fit in memory. The plate lives in
+ * a file, h rows of w doubles in the machine's byte order, mapped into memory
+ * and streamed through it a band of rows at a time: the next band is read
+ * ahead (madvise WILLNEED) while the current one is calculated, and finished
+ * bands are written back (sync_file_range) and dropped from the mapping.
+ *
+ * Each pass over the file advances up to levels timesteps, so the disk traffic
+ * per timestep is divided by levels. The timesteps are skewed: when row r of
+ * the file is read, level 1 calculates row r - 1 of the next timestep, level 2
+ * row r - 2 of the one after that and so on, each level keeping the last 3
+ * rows it calculated in memory for the next level. Only the last level writes
+ * to the file, to rows no one needs anymore. The results are the same as
+ * going through the whole plate once per timestep.
+ */
+#include "dry.h"
+#include <stddef.h>
+
+struct ooc {
+  int fd;
+  /* The mapped plate */
+  double *surface;
+  size_t w, h, size;
+  /* 3 rows per level, one after the other */
+  double *rings;
+  unsigned levels;
+  /* Rows streamed at a time */
+  size_t band;
+};
+
+/*
+ * Creates filename (truncating it) for a w x h plate, advancing up to levels
+ * timesteps per pass, and maps it to ooc->surface, for the caller to fill
+ * with the initial state. Returns 0 on success, 1 on error, reporting the
+ * error to stderr. On error, nothing is left open.
+ */
+int
+ooc_create(struct ooc *ooc, char const *filename, DRY(size_t, w, h),
+    unsigned levels);
+
+/*
+ * Advances the plate steps (<= levels) timesteps in a single pass over the
+ * file. Returns 0 on success, 1 on error, reporting the error to stderr.
+ */
+int
+ooc_advance(struct ooc *ooc, unsigned steps, double alpha);
+
+/*
+ * Writes the plate back to the file and closes it. Returns 0 on success, 1 on
+ * error, reporting the error to stderr. The file is closed either way.
+ */
+int
+ooc_close(struct ooc *ooc);
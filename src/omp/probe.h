@@ -0,0 +1,184 @@
+#pragma once
+/*
+ * Probes: time series of a few cells of the plate, for when the full plate at
+ * every iteration is way more than needed. A probe is described by a SPEC:
+ *
+ *   point:X,Y          a single cell
+ *   line:X0,Y0,X1,Y1   the cells on the segment between two cells (Bresenham)
+ *   rect:X0,Y0,X1,Y1   the cells of the rectangle with those corners
+ *
+ * where X is the column and Y the row, both starting at 0. Probe K is written
+ * to probeK.bin, which starts with a text header
+ *
+ *   PROBE SPEC CELLS\n
+ *
+ * followed by one record per sample: the iteration as an uint64_t and then the
+ * temperature of each cell as a double (rects are in row-major order), all in
+ * the machine's byte order.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Size of the stdio buffer of each probe file */
+#define PROBE_BUFFER 1048576
+
+struct probe {
+  FILE *f;
+  /* Offsets of the cells into the surface */
+  size_t *cells;
+  size_t n;
+  /* The last sample */
+  double *values;
+};
+
+/* Parses "X0,Y0,X1,Y1" (or "X,Y" if coords is 2) into c */
+static int
+probe_coords(char const *s, size_t *c, int coords)
+{
+  unsigned long long v[4];
+  int read = 0;
+  int rc = coords == 2 ? sscanf(s, "%llu,%llu%n", v, v + 1, &read) :
+    sscanf(s, "%llu,%llu,%llu,%llu%n", v, v + 1, v + 2, v + 3, &read);
+  if (rc != coords || s[read] != '\0')
+    return 1;
+  for (int i = 0; i < coords; i++)
+    c[i] = (size_t)v[i];
+  return 0;
+}
+
+/*
+ * Parses spec into the cells of a w x h surface, with rows pitch doubles
+ * apart. Returns 0 on success, 1 on error, reporting the error to stderr.
+ */
+static int
+probe_cells(struct probe *probe, char const *spec, DRY(size_t, w, h, pitch))
+{
+  size_t c[4];
+  int kind;
+  if (!strncmp(spec, "point:", 6) && !probe_coords(spec + 6, c, 2)) {
+    kind = 'p';
+    c[2] = c[0];
+    c[3] = c[1];
+  } else if (!strncmp(spec, "line:", 5) && !probe_coords(spec + 5, c, 4)) {
+    kind = 'l';
+  } else if (!strncmp(spec, "rect:", 5) && !probe_coords(spec + 5, c, 4)) {
+    kind = 'r';
+  } else {
+    LOG_ERROR("Invalid probe: %s\n", spec);
+    return 1;
+  }
+  if (c[0] >= w || c[2] >= w || c[1] >= h || c[3] >= h) {
+    LOG_ERROR("Probe %s is outside the %zux%zu surface\n", spec, w, h);
+    return 1;
+  }
+  size_t x0 = c[0] < c[2] ? c[0] : c[2], x1 = c[0] < c[2] ? c[2] : c[0];
+  size_t y0 = c[1] < c[3] ? c[1] : c[3], y1 = c[1] < c[3] ? c[3] : c[1];
+  size_t dx = x1 - x0, dy = y1 - y0;
+  /* A line never has more cells than its longest side */
+  size_t n = kind == 'r' ? (dx + 1) * (dy + 1) : (dx > dy ? dx : dy) + 1;
+  probe->cells = malloc(n * sizeof(*probe->cells));
+  probe->values = malloc(n * sizeof(*probe->values));
+  if (!probe->cells || !probe->values) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  if (kind == 'r') {
+    for (size_t y = y0; y <= y1; y++)
+      for (size_t x = x0; x <= x1; x++)
+        probe->cells[probe->n++] = y * pitch + x;
+    return 0;
+  }
+  /* Bresenham, from (c[0], c[1]) to (c[2], c[3]) */
+  long long x = (long long)c[0], y = (long long)c[1];
+  long long ex = (long long)c[2], ey = (long long)c[3];
+  long long sx = x < ex ? 1 : -1, sy = y < ey ? 1 : -1;
+  long long ldx = (long long)dx, ldy = -(long long)dy, err = ldx + ldy;
+  for (;;) {
+    probe->cells[probe->n++] = (size_t)y * pitch + (size_t)x;
+    if (x == ex && y == ey)
+      break;
+    if (2 * err >= ldy) {
+      err += ldy;
+      x += sx;
+    }
+    if (2 * err <= ldx) {
+      err += ldx;
+      y += sy;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Sets up probe id as described by spec for a w x h surface, with rows pitch
+ * doubles apart, creating its file. Returns 0 on success, 1 on error,
+ * reporting the error to stderr. On error, call probe_free anyway.
+ */
+static int
+probe_init(struct probe *probe, char const *spec, DRY(size_t, w, h, pitch),
+    unsigned id)
+{
+  memset(probe, 0, sizeof(*probe));
+  if (probe_cells(probe, spec, w, h, pitch))
+    return 1;
+  char filename[256];
+  int rc = snprintf(filename, 256, "probe%u.bin", id);
+  if (rc < 0 || rc >= 256) {
+    LOG_ERROR("Generating filename for probe %u\n", id);
+    return 1;
+  }
+  probe->f = fopen(filename, "w");
+  if (!probe->f) {
+    LOG_ERROR("Opening %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  /* Samples are tiny, let stdio batch them into large writes */
+  if (setvbuf(probe->f, NULL, _IOFBF, PROBE_BUFFER))
+    LOG_WARNING("%s: Could not set the buffer, writes will be small\n",
+        filename);
+  if (fprintf(probe->f, "PROBE %s %zu\n", spec, probe->n) < 0) {
+    LOG_ERROR("%s: Could not write header: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Appends the probed cells of surface at iteration iter. Returns 0 on success,
+ * 1 on error, reporting the error to stderr.
+ */
+static int
+probe_sample(struct probe *probe, double const *surface, uint64_t iter)
+{
+  for (size_t i = 0; i < probe->n; i++)
+    probe->values[i] = surface[probe->cells[i]];
+  if (fwrite(&iter, sizeof(iter), 1, probe->f) != 1 ||
+      fwrite(probe->values, sizeof(*probe->values), probe->n, probe->f) !=
+      probe->n) {
+    LOG_ERROR("Probe: Could not write iter %"PRIu64": %s\n", iter,
+        strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Flushes and closes the probe. Returns 0 on success, 1 on error, reporting
+ * the error to stderr.
+ */
+static int
+probe_free(struct probe *probe)
+{
+  int ans = 0;
+  if (probe->f && fclose(probe->f)) {
+    LOG_ERROR("Probe: Could not close file: %s\n", strerror(errno));
+    ans = 1;
+  }
+  free(probe->cells);
+  free(probe->values);
+  memset(probe, 0, sizeof(*probe));
+  return ans;
+}
@@ -0,0 +1,137 @@
+#include "spectral.h"
+#include "logging.h"
+#include <errno.h>
+#include <math.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPECTRAL_PI 3.14159265358979323846
+
+/* Neighbours of a point in a stencil: offsets and weights */
+struct spectral_neighbour {
+  int di, dj;
+  double weight;
+};
+
+static struct spectral_neighbour const SPECTRAL_5[] = {
+  {-1, 0, 1.0}, {1, 0, 1.0}, {0, -1, 1.0}, {0, 1, 1.0}
+};
+
+static struct spectral_neighbour const SPECTRAL_9[] = {
+  {-1, 0, 4 / 6.0}, {1, 0, 4 / 6.0}, {0, -1, 4 / 6.0}, {0, 1, 4 / 6.0},
+  {-1, -1, 1 / 6.0}, {-1, 1, 1 / 6.0}, {1, -1, 1 / 6.0}, {1, 1, 1 / 6.0}
+};
+
+/* The 2D DST of the ny rows of nx points of grid, in place */
+static void
+spectral_transform(struct spectral *spectral, double *grid)
+{
+  size_t nx = spectral->nx, ny = spectral->ny;
+#pragma omp parallel
+  {
+    struct dst_complex *work = spectral->work +
+      (size_t)omp_get_thread_num() * spectral->works;
+#pragma omp for
+    for (size_t i = 0; i < ny; i++)
+      dst_apply(&spectral->x, grid + i * nx, 1, work);
+#pragma omp for
+    for (size_t j = 0; j < nx; j++)
+      dst_apply(&spectral->y, grid + j, (ptrdiff_t)nx, work);
+  }
+}
+
+int
+spectral_init(struct spectral *spectral, enum stencil stencil, double const
+    *surface, DRY(size_t, w, h, pitch))
+{
+  memset(spectral, 0, sizeof(*spectral));
+  if (w < 3 || h < 3 || STENCIL_HALO[stencil] > 1) {
+    LOG_ERROR("Spectral: Plates should be at least 3 x 3, and the stencil 5 "
+        "or 9 points\n");
+    return 1;
+  }
+  size_t nx = spectral->nx = w - 2, ny = spectral->ny = h - 2;
+  if (dst_init(&spectral->x, nx) || dst_init(&spectral->y, ny))
+    return 1;
+  spectral->works = spectral->x.l > spectral->y.l ? spectral->x.l :
+    spectral->y.l;
+  spectral->steady = malloc(nx * ny * sizeof(double));
+  spectral->modes = malloc(nx * ny * sizeof(double));
+  spectral->grid = malloc(nx * ny * sizeof(double));
+  spectral->eigen = malloc(nx * ny * sizeof(double));
+  spectral->work = malloc((size_t)omp_get_max_threads() * spectral->works *
+      sizeof(*spectral->work));
+  if (!spectral->steady || !spectral->modes || !spectral->grid ||
+      !spectral->eigen || !spectral->work) {
+    LOG_ERROR("%d: %s\n", __LINE__, strerror(errno));
+    return 1;
+  }
+  struct spectral_neighbour const *neighbours = stencil == STENCIL_9 ?
+    SPECTRAL_9 : SPECTRAL_5;
+  size_t nneighbours = stencil == STENCIL_9 ? 8 : 4;
+  double *grid = spectral->grid;
+#pragma omp parallel for
+  for (size_t i = 0; i < ny; i++) {
+    double d = cos(SPECTRAL_PI * (double)(i + 1) / (double)(ny + 1));
+    for (size_t j = 0; j < nx; j++) {
+      double c = cos(SPECTRAL_PI * (double)(j + 1) / (double)(nx + 1));
+      spectral->eigen[i * nx + j] = stencil == STENCIL_9 ? (8 * c + 8 * d + 4
+          * c * d - 20) / 6 : 2 * c + 2 * d - 4;
+      /* What the edges add to the Laplacian of the point */
+      double edges = 0.0;
+      for (size_t k = 0; k < nneighbours; k++) {
+        size_t y = (size_t)((ptrdiff_t)i + 1 + neighbours[k].di);
+        size_t x = (size_t)((ptrdiff_t)j + 1 + neighbours[k].dj);
+        if (!y || !x || y == h - 1 || x == w - 1)
+          edges += neighbours[k].weight * surface[y * pitch + x];
+      }
+      grid[i * nx + j] = edges;
+    }
+  }
+  /* The steady state has a zero Laplacian: inside + edges = 0 */
+  double norm = 4 / ((double)(nx + 1) * (double)(ny + 1));
+  spectral_transform(spectral, grid);
+  for (size_t k = 0; k < nx * ny; k++)
+    grid[k] *= -norm / spectral->eigen[k];
+  spectral_transform(spectral, grid);
+  memcpy(spectral->steady, grid, nx * ny * sizeof(*grid));
+  for (size_t i = 0; i < ny; i++)
+    for (size_t j = 0; j < nx; j++)
+      grid[i * nx + j] = surface[(i + 1) * pitch + j + 1] - spectral->steady[i
+        * nx + j];
+  spectral_transform(spectral, grid);
+  memcpy(spectral->modes, grid, nx * ny * sizeof(*grid));
+  return 0;
+}
+
+void
+spectral_at(struct spectral *spectral, double *surface, size_t pitch, double
+    timesteps, double alpha)
+{
+  size_t nx = spectral->nx, ny = spectral->ny;
+  double norm = 4 / ((double)(nx + 1) * (double)(ny + 1));
+  double *grid = spectral->grid;
+#pragma omp parallel for
+  for (size_t k = 0; k < nx * ny; k++)
+    grid[k] = norm * spectral->modes[k] * exp(spectral->eigen[k] * alpha *
+        timesteps);
+  spectral_transform(spectral, grid);
+#pragma omp parallel for
+  for (size_t i = 0; i < ny; i++)
+    for (size_t j = 0; j < nx; j++)
+      surface[(i + 1) * pitch + j + 1] = spectral->steady[i * nx + j] +
+        grid[i * nx + j];
+}
+
+void
+spectral_free(struct spectral *spectral)
+{
+  dst_free(&spectral->x);
+  dst_free(&spectral->y);
+  free(spectral->steady);
+  free(spectral->modes);
+  free(spectral->grid);
+  free(spectral->eigen);
+  free(spectral->work);
+}
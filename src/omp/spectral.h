@@ -0,0 +1,65 @@
+#pragma once
+/*
+ * Spectral engine: the plate at any time in O(w h log(w h)), however far it
+ * is from the start, instead of a timestep at a time.
+ *
+ * With constant diffusivity and fixed edges, the Laplacian of a stencil (5 or
+ * 9, see stencil.h) on the interior of the plate is diagonal in the discrete
+ * sine basis: mode (p, q) is an eigenvector with eigenvalue, for c = cos(pi
+ * (p + 1) / (w - 1)) and d = cos(pi (q + 1) / (h - 1)),
+ *
+ *   5   2 c + 2 d - 4
+ *   9   (8 c + 8 d + 4 c d - 20) / 6
+ *
+ * So the plate is split in the steady state, which the edges alone settle
+ * to, and the rest, which is zero on the edges and whose modes each decay
+ * exponentially: by exp(eigenvalue alpha k) after k timesteps. That is the
+ * exact solution in time of the plate discretised in space, where timesteps
+ * of forward Euler only approximate it (to first order in the timestep), so
+ * the results differ from those of the other engines by that error. The
+ * steady state is found in the same basis, solving its Laplace equation.
+ *
+ * The initial plate is transformed once (see dst.h), and each plate asked for
+ * is transformed back, in parallel along the rows and then the columns.
+ * 13-point stencils are not diagonal in this basis (see stencil.h), so they
+ * are not supported.
+ */
+#include "dry.h"
+#include "dst.h"
+#include "stencil.h"
+#include <stddef.h>
+
+struct spectral {
+  /* The interior of the plate, w - 2 x h - 2 */
+  size_t nx, ny;
+  struct dst x, y;
+  /* The steady state (rows of nx points), the modes of the initial plate
+   * minus it, and where plates are transformed back */
+  double *steady, *modes, *grid;
+  /* The eigenvalues of the modes, rows of nx */
+  double *eigen;
+  /* Work for dst_apply, for each thread */
+  struct dst_complex *work;
+  size_t works;
+};
+
+/*
+ * Transforms the w x h (>= 3 x 3) surface, with rows pitch doubles apart, for
+ * stencil (5 or 9). Returns 0 on success, 1 on error, reporting the error to
+ * stderr. On error, call spectral_free anyway.
+ */
+int
+spectral_init(struct spectral *spectral, enum stencil stencil, double const
+    *surface, DRY(size_t, w, h, pitch));
+
+/*
+ * Writes the plate after timesteps of alpha (see stencil.h) into the interior
+ * of surface (the one spectral_init was called with, or one with the same
+ * edges), whose rows are pitch doubles apart. timesteps need not be whole.
+ */
+void
+spectral_at(struct spectral *spectral, double *surface, size_t pitch, double
+    timesteps, double alpha);
+
+void
+spectral_free(struct spectral *spectral);
@@ -0,0 +1,210 @@
+/* for gethostname */
+#define _POSIX_C_SOURCE 200112L
+#include "tune.h"
+#include "logging.h"
+#include <errno.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Candidates for the tile search */
+static size_t const TUNE_TILES[] = {128, 512, 2048};
+
+/* Longest line of the cache */
+#define TUNE_LINE 256
+
+void
+tune_default(struct tune *tune)
+{
+  tune->threads = omp_get_max_threads();
+  tune->tile = 0;
+}
+
+void
+tune_apply(struct tune const *tune)
+{
+  if (!getenv("OMP_NUM_THREADS"))
+    omp_set_num_threads(tune->threads);
+}
+
+/*
+ * Parses a line of the cache into its kernel k (16 bytes), plate size lw x lh
+ * and tune. Returns 0 on success, 1 if it is not such a line.
+ */
+static int
+tune_line(char const *line, char *k, size_t *lw, size_t *lh, struct tune
+    *tune)
+{
+  double seconds;
+  return sscanf(line, "%15s %zu %zu %d %zu %lf", k, lw, lh, &tune->threads,
+      &tune->tile, &seconds) != 6 || tune->threads < 1;
+}
+
+/* Writes the path of the cache to path. Returns 0 on success, 1 on error. */
+static int
+tune_path(char *path, size_t size)
+{
+  char const *env = getenv("HEAT_TUNE_CACHE");
+  if (env && *env) {
+    int rc = snprintf(path, size, "%s", env);
+    return rc < 0 || (size_t)rc >= size;
+  }
+  char host[256];
+  if (gethostname(host, sizeof(host)))
+    strcpy(host, "localhost");
+  host[sizeof(host) - 1] = '\0';
+  char const *dir = getenv("XDG_CACHE_HOME");
+  char const *home = getenv("HOME");
+  int rc = dir && *dir ? snprintf(path, size, "%s/heat-tune.%s", dir, host) :
+    snprintf(path, size, "%s/.cache/heat-tune.%s", home ? home : ".", host);
+  return rc < 0 || (size_t)rc >= size;
+}
+
+int
+tune_load(struct tune *tune, char const *kernel, DRY(size_t, w, h))
+{
+  char path[4096];
+  if (tune_path(path, sizeof(path)))
+    return 1;
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 1;
+  int ans = 1;
+  /* How many times larger or smaller than the plate the best line is */
+  double best = 0.0;
+  char line[TUNE_LINE];
+  while (fgets(line, sizeof(line), f)) {
+    struct tune t;
+    char k[16];
+    size_t lw, lh;
+    if (tune_line(line, k, &lw, &lh, &t) || strcmp(k, kernel))
+      continue;
+    double ratio = (double)(lw * lh) / (double)(w * h);
+    ratio = ratio < 1 ? 1 / ratio : ratio;
+    if (ans || ratio < best) {
+      *tune = t;
+      best = ratio;
+      ans = 0;
+    }
+  }
+  fclose(f);
+  if (!ans)
+    LOG_INFO("Tune: %d threads, tiles of %zu from %s\n", tune->threads,
+        tune->tile, path);
+  return ans;
+}
+
+/*
+ * Replaces the line of kernel for w x h plates in the cache with tune, taking
+ * seconds per timestep. The new cache is written next to the old one and
+ * renamed over it, so concurrent runs never see half a cache. Returns 0 on
+ * success, 1 on error, reporting the error to stderr.
+ */
+static int
+tune_save(struct tune const *tune, char const *kernel, DRY(size_t, w, h),
+    double seconds)
+{
+  char path[4096], tmp[4200], line[TUNE_LINE];
+  if (tune_path(path, sizeof(path))) {
+    LOG_ERROR("Tune: The path of the cache is too long\n");
+    return 1;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+  /* ~/.cache may not be there yet */
+  char *slash = strrchr(path, '/');
+  if (slash) {
+    *slash = '\0';
+    mkdir(path, 0755);
+    *slash = '/';
+  }
+  FILE *out = fopen(tmp, "w");
+  if (!out) {
+    LOG_ERROR("Tune: Opening %s: %s\n", tmp, strerror(errno));
+    return 1;
+  }
+  fprintf(out, "# KERNEL W H THREADS TILE SECONDS\n");
+  FILE *in = fopen(path, "r");
+  if (in) {
+    while (fgets(line, sizeof(line), in)) {
+      char k[16];
+      size_t lw, lh;
+      struct tune t;
+      /* Lines in an older format are dropped along with the header */
+      if (tune_line(line, k, &lw, &lh, &t) || (!strcmp(k, kernel) && lw == w
+            && lh == h))
+        continue;
+      fputs(line, out);
+    }
+    fclose(in);
+  }
+  fprintf(out, "%s %zu %zu %d %zu %g\n", kernel, w, h, tune->threads,
+      tune->tile, seconds);
+  if (fclose(out) || rename(tmp, path)) {
+    LOG_ERROR("Tune: Writing %s: %s\n", path, strerror(errno));
+    remove(tmp);
+    return 1;
+  }
+  LOG_INFO("Tune: Saved to %s\n", path);
+  return 0;
+}
+
+/*
+ * Times step with candidate, making it the best if it beats seconds, the time
+ * per timestep of best
+ */
+static void
+tune_try(struct tune *best, double *seconds, struct tune const *candidate,
+    void (*step)(struct tune const *, void *), void *data)
+{
+  tune_apply(candidate);
+  /* Warms up the caches and the threads */
+  step(candidate, data);
+  unsigned steps = 0;
+  double start = omp_get_wtime(), now;
+  do {
+    step(candidate, data);
+    steps++;
+    now = omp_get_wtime();
+  } while (now - start < TUNE_TRIAL || steps < 3);
+  double ans = (now - start) / steps;
+  LOG_DEBUG("Tune: %d threads, tiles of %zu: %g s\n", candidate->threads,
+      candidate->tile, ans);
+  if (*seconds < 0 || ans < *seconds) {
+    *best = *candidate;
+    *seconds = ans;
+  }
+}
+
+int
+tune_search(struct tune *tune, char const *kernel, DRY(size_t, w, h),
+    void (*step)(struct tune const *, void *), void *data)
+{
+  struct tune best, candidate;
+  double seconds = -1.0;
+  tune_default(&best);
+  tune_try(&best, &seconds, &best, step, data);
+  /* Thread counts: powers of 2 up to every processor */
+  int procs = omp_get_num_procs();
+  for (int t = 1; !getenv("OMP_NUM_THREADS"); t *= 2) {
+    candidate = best;
+    candidate.threads = t < procs ? t : procs;
+    tune_try(&best, &seconds, &candidate, step, data);
+    if (t >= procs)
+      break;
+  }
+  /* Tiles narrower than the plate */
+  for (size_t t = 0; t < sizeof(TUNE_TILES) / sizeof(*TUNE_TILES); t++) {
+    if (TUNE_TILES[t] + 2 >= w)
+      break;
+    candidate = best;
+    candidate.tile = TUNE_TILES[t];
+    tune_try(&best, &seconds, &candidate, step, data);
+  }
+  *tune = best;
+  LOG_INFO("Tune: %d threads, tiles of %zu: %g s per timestep\n",
+      best.threads, best.tile, seconds);
+  return tune_save(tune, kernel, w, h, seconds);
+}
@@ -0,0 +1,61 @@
+#pragma once
+/*
+ * Autotuning of the timestep loop (see heat_advance in libheat.h): how many
+ * threads, each keeping a band of rows, and whether each row is calculated
+ * whole or in tiles of columns (so the three rows a tile reads stay in cache
+ * on plates too wide for it). The best of these depends on the plate and the
+ * machine, so it is found with short timed trials and kept in a cache file for
+ * later runs on the same machine to pick up.
+ *
+ * The search goes one knob at a time (threads, then tiles), keeping the best
+ * so far for the other, so it takes a handful of trials rather than every
+ * combination.
+ *
+ * The cache file is $HEAT_TUNE_CACHE if set, otherwise heat-tune.HOSTNAME in
+ * $XDG_CACHE_HOME (or ~/.cache), so machines sharing a home directory do not
+ * share results. It has a line per kernel and plate size:
+ *
+ *   KERNEL W H THREADS TILE SECONDS
+ *
+ * where SECONDS is the time per timestep of the best trial. Runs use the line
+ * with their kernel and the plate size closest to theirs.
+ */
+#include "dry.h"
+#include <stddef.h>
+
+/* Seconds (at least) each trial runs for */
+#define TUNE_TRIAL 0.05
+
+struct tune {
+  int threads;
+  /* Columns per tile, 0 for whole rows */
+  size_t tile;
+};
+
+/* The configuration without tuning: every thread, whole rows */
+void
+tune_default(struct tune *tune);
+
+/*
+ * Loads the configuration of the cache closest to a w x h plate with kernel
+ * into tune. Returns 0 if there is one, 1 otherwise (leaving tune alone).
+ */
+int
+tune_load(struct tune *tune, char const *kernel, DRY(size_t, w, h));
+
+/*
+ * Finds the fastest configuration for a w x h plate into tune, timing step(tune,
+ * data), a single timestep, with each candidate. Saves it to the cache under
+ * kernel. Returns 0 on success, 1 if it could not be saved, reporting the
+ * error to stderr (tune is set either way).
+ */
+int
+tune_search(struct tune *tune, char const *kernel, DRY(size_t, w, h),
+    void (*step)(struct tune const *, void *), void *data);
+
+/*
+ * Makes tune the configuration of the following parallel regions. Thread
+ * counts set with OMP_NUM_THREADS win.
+ */
+void
+tune_apply(struct tune const *tune);